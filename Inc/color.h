@@ -25,6 +25,50 @@ typedef struct {
     uint8_t lightness;
 } Color_HSL;
 
+// HSL in fixed point, for the fast conversion
+typedef struct {
+    // Hue as a fraction of the full circle, 0 to 65535
+    uint16_t hue;
+
+    // Saturation in 0 to 255
+    uint8_t saturation;
+
+    // Lightness in 0 to 255
+    uint8_t lightness;
+} Color_HSL8;
+
+// Generated at build time by tools/gen_color_tables.py, see the Makefile
+extern const uint8_t color_gamma_table[256];
+extern const Color_RGB color_hue_table[257];
+
+// Reference conversion in floating point. Slow, as doubles are done in
+// software on the Cortex-M4, so animations should use the ones below.
 Color_RGB color_hsl_to_rgb(Color_HSL);
 
+// Same as color_hsl_to_rgb in integer maths, rounding where that truncates,
+// so channels come out up to 3 steps apart
+Color_RGB color_hsl_to_rgb_fixed(Color_HSL);
+
+// Interpolates the hue table, no floating point or division
+Color_RGB color_hsl8_to_rgb(Color_HSL8);
+
+// Maps a linear brightness to an LED duty cycle
+static inline uint8_t color_gamma(uint8_t value) {
+    return color_gamma_table[value];
+}
+
+// Scales a colour by a brightness, 255 leaving it as it is
+static inline Color_RGB color_scale(Color_RGB rgb, uint8_t brightness) {
+    uint16_t factor = brightness + 1;
+
+    rgb.red = (rgb.red * factor) >> 8;
+    rgb.green = (rgb.green * factor) >> 8;
+    rgb.blue = (rgb.blue * factor) >> 8;
+
+    return rgb;
+}
+
+// Gamma corrects and scales a buffer of RGB pixels in place
+void color_correct_pixels(uint8_t * rgb, uint16_t pixel_count, uint8_t brightness);
+
 #endif
\ No newline at end of file
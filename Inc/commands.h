@@ -6,6 +6,8 @@ typedef enum {
   Command_Request_Sensors = 0x01,
   Command_Process_LED_Segment = 0x02,
   Command_Commit_LEDs = 0x03,
+  Command_Set_Thresholds = 0x04,
+  Command_Request_Press_Mask = 0x05,
 
   Command_Test_Expect_2B = 0x71,
   Command_Test_Expect_64B = 0x72,
@@ -7,12 +7,19 @@
 // File for configuration #define FLAGS
 
 
-// Change these if depending on what you've got plugged in
+// Panels are found at runtime (see panel_detect.h). Set one of these to 1 to
+// have that panel taken as connected regardless.
 #define PANEL_LEFT_CONNECTED  (0U) 
 #define PANEL_UP_CONNECTED    (0U) 
 #define PANEL_DOWN_CONNECTED  (0U)
 #define PANEL_RIGHT_CONNECTED (0U)
 
+// Set to 1 to handle LED segments in the USB interrupt as soon as they
+// arrive, starting the UART transfer to an idle panel right there instead of
+// waiting for the main loop to get round to the packet
+#define LED_ISR_FAST_PATH (0U)
+
+// Kept up to date by panel_detect
 extern uint8_t _panels_connected[4];
 
 inline uint8_t panel_connected(ComportId port) {
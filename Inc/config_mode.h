@@ -19,6 +19,8 @@ typedef enum {
 typedef enum {
     PROFILE_PUSH_PACKET = 0xF0,
     PROFILE_READ_PACKET = 0xF1,
+    PROFILE_SAVED_PACKET = 0xF2,    // To the host, once a pushed profile is saved
+    PROFILE_SWITCH_PACKET = 0xF3,   // Makes slot packet[1] active, answered with the active slot
 } config_packets_t;
 
 bool is_config_mode(void);
@@ -4,20 +4,66 @@
 #include "stm32f3xx_hal.h"  // Ensure the HAL header is included
 
 /* Flash memory mapping for configuration data:
- * Reserve one flash page.
- * For a 512KB device, use 0x0807F800.
- * For a 256KB device, use 0x0803F800.
+ * The last two flash pages hold a log of configuration records, used in
+ * turn. The linker script keeps the program out of them.
+ * For a 512KB device, use 0x0807F000.
+ * For a 256KB device, use 0x0803F000.
  */
-#define CONFIG_START_ADDR   0x0803F800      // Start address of reserved flash page
+#define CONFIG_LOG_PAGE_A   0x0803F000      // Start addresses of the two log pages
+#define CONFIG_LOG_PAGE_B   0x0803F800
 #define CONFIG_PAGE_SIZE    0x800U          // 2 KB per page
-#define CONFIG_END_ADDR     (CONFIG_START_ADDR + CONFIG_PAGE_SIZE - 1)
+
+/* Firmware before the record log kept its data at the start of this page */
+#define CONFIG_LEGACY_ADDR  CONFIG_LOG_PAGE_B
+
+/* Record keys, 0xFF is reserved */
+#define CONFIG_KEY_MAX      0xFEU
+
+/* Records waiting to be written, and the largest record that can be queued */
+#define EPEMUL_QUEUE_LENGTH         4U
+#define EPEMUL_QUEUE_RECORD_MAX     64U
+
+/* Called by epemul_task once a queued record is in flash, or failed to go in */
+typedef void (*EpemulWriteDone)(uint8_t key, HAL_StatusTypeDef status);
 
 /* API Functions */
 
-HAL_StatusTypeDef epemul_erase_config_page(void);
+/* Enables the flash interrupt, which ends page erases */
+void epemul_init(void);
+
+HAL_StatusTypeDef epemul_erase_page(uint32_t page_addr);
 HAL_StatusTypeDef epemul_write_doubleword(uint32_t address, uint64_t data);
-HAL_StatusTypeDef epemul_write_config_data(uint8_t *data, uint32_t index, uint32_t size);
-void epemul_read_config_data(uint8_t *data, uint32_t index, uint32_t size);
-uint32_t epemul_search_valid_addr(void);
+
+/*
+ * Queues a record for the key to be appended to the log, unless the newest
+ * record for the key already holds the same data by the time it's up. When
+ * the page is full, the newest record of every key is copied to the other
+ * page along with the new one, and that page takes over.
+ * The data is copied, and done (if not NULL) is called from epemul_task when
+ * the record is written. Returns HAL_BUSY if the queue is full.
+ */
+HAL_StatusTypeDef epemul_queue_record(uint8_t key, const uint8_t *data, uint16_t len, EpemulWriteDone done);
+
+/* Whether any queued record has yet to be written */
+uint8_t epemul_busy(void);
+
+/*
+ * Moves the queued writes along by a few doublewords. Posts EVENT_FLASH
+ * while there's more to do, so it's to be called on that event.
+ */
+void epemul_task(void);
+
+/*
+ * Copies the newest record for the key into data, up to size bytes. A
+ * queued record counts as newer than any in flash.
+ * Returns the record's length, or 0 if there is no valid record for the key.
+ */
+uint16_t epemul_read_record(uint8_t key, uint8_t *data, uint16_t size);
+
+/*
+ * Copies size bytes saved by firmware from before the record log. Returns
+ * 0 if the page has since been taken over by the log.
+ */
+uint8_t epemul_read_legacy(uint8_t *data, uint32_t size);
 
 #endif /* EEPROM_EMUML_H_ */
@@ -19,11 +19,15 @@ typedef enum {
     Error_HAL_UART_Init                    = 0x1107, 
     Error_HAL_UART_DeInit                  = 0x1108,
     Error_HAL_PCD_Init                     = 0x1109,
+    Error_HAL_TIM_Init                     = 0x110A,
+    Error_HAL_TIM_Start                    = 0x110B,
+    Error_HAL_UART_Error                   = 0x110C,
     Error_USB_USBD_Init                    = 0x1201,
     Error_USB_USBD_RegisterClass           = 0x1202,
     Error_USB_USBD_RegisterInterface       = 0x1203,
     Error_USB_USBD_Start                   = 0x1204,
     Error_USB_USBD_ConfWrongSpeed          = 0x1205,
+    Error_RTOS_KernelStart                 = 0x1301,
     Error_App_UART_InvalidComport          = 0x2101,
     Error_App_MsgBus_InvalidComport        = 0x2201,
     Error_App_MsgBus_SendCpltInvalidStatus = 0x2202,
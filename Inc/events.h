@@ -0,0 +1,56 @@
+#ifndef __EVENTS_H
+#define __EVENTS_H
+
+#include "stm32f3xx.h"
+
+#ifdef USE_CMSIS_RTOS
+#include "cmsis_os.h"
+#endif
+
+// Work for the main loop, flagged by interrupt handlers. The main loop
+// sleeps until at least one event is pending and then only runs the parts
+// that the pending events call for. In the RTOS build events are instead
+// routed to the message queues of the tasks that handle them.
+
+// A UART send or receive completed
+#define EVENT_BUS (0x01U)
+
+// An event was queued for tud_task
+#define EVENT_USB (0x02U)
+
+// USB Start-of-Frame, every millisecond while the host is connected
+#define EVENT_SOF (0x04U)
+
+// SysTick, every millisecond
+#define EVENT_TICK (0x08U)
+
+// The USB interrupt completed an LED frame, which led_frame_task commits
+#define EVENT_LED (0x10U)
+
+// Sensor poll timer, at the profile's poll rate
+#define EVENT_POLL (0x20U)
+
+// Time to queue the sensor report, ahead of the host's next IN token
+#define EVENT_REPORT (0x40U)
+
+// Queued flash writes can move on, or one has finished (see eeprom_emul.h)
+#define EVENT_FLASH (0x80U)
+
+// Flags events as pending. Safe to call from interrupts and the main loop.
+void events_post(uint32_t events);
+
+#ifdef USE_CMSIS_RTOS
+
+// Has the given events put on a task's message queue, as the message value.
+// Set up all routes before the kernel starts.
+void events_route(uint32_t events, osMessageQId queue);
+
+#else
+
+// Sleeps until an event is pending, then returns and clears all pending
+// events. Only to be called from the main loop.
+uint32_t events_wait();
+
+#endif
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __GAMEPAD_H
+#define __GAMEPAD_H
+
+#include "stm32f3xx.h"
+
+// Sends the gamepad report if the button state has changed since the last
+// one went out. To be called every main loop iteration.
+void gamepad_task();
+
+#endif
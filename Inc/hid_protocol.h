@@ -0,0 +1,83 @@
+#ifndef __HID_PROTOCOL_H
+#define __HID_PROTOCOL_H
+
+#include "stm32f3xx.h"
+
+#define HID_PACKET_SIZE (64U)
+
+// Framing of the 64 byte packets on the data interface, chosen per session.
+//
+// Legacy (version 0), what older tools speak and the default after every
+// mount: packets are LED segments, with their header byte as described in
+// led_frame.h. The config mode magic packets switch to config mode, where
+// packets are config commands with one of the PROFILE_*_PACKET headers of
+// config_mode.h instead.
+//
+// Typed (version 1), chosen by sending the version query magic packet:
+//   byte 0, bit 7 clear: LED segment. Bits 6-5 panel, bits 4-3 segment and
+//           bits 2-0 frame number, followed by the 21 RGB pixels.
+//   byte 0, bit 7 set:   typed packet, byte 0 being one of HidPacketType
+//           and the rest its payload.
+// Every type is dispatched through a table indexed by byte 0. Replies and
+// sensor reports to the host start with their type as well.
+//
+// Either way a config mode magic packet (re)starts a legacy session, so old
+// tools keep working after a newer one has been used.
+#define HID_PROTOCOL_LEGACY (0U)
+#define HID_PROTOCOL_TYPED (1U)
+#define HID_PROTOCOL_NEWEST HID_PROTOCOL_TYPED
+
+#define HID_PACKET_TYPED_FLAG (0x80U)
+#define HID_PACKET_TYPE_COUNT (0x80U)
+
+typedef enum {
+    // Host: query. Device: [current version][newest version]
+    HID_PACKET_VERSION = 0x80,
+    // Host: the active slot's profile, 63 bytes. Device: HID_PACKET_PROFILE_SAVED later
+    HID_PACKET_PROFILE_PUSH = 0x81,
+    // Host: query. Device: the active slot's profile, 63 bytes
+    HID_PACKET_PROFILE_READ = 0x82,
+    // Device: [HAL status] once a pushed profile is in flash
+    HID_PACKET_PROFILE_SAVED = 0x83,
+    // Host: [slot]. Device: [active slot][slot count]
+    HID_PACKET_PROFILE_SWITCH = 0x84,
+    // Host: query. Device: a telemetry snapshot, see main.c
+    HID_PACKET_TELEMETRY = 0x85,
+    // Device: the sensor report of sensor_report.h, shifted up by a byte
+    HID_PACKET_SENSOR_REPORT = 0x86,
+    // Host: back to legacy framing, no reply
+    HID_PACKET_LEGACY = 0x87,
+} HidPacketType;
+
+// Handles a typed packet. A handler that writes a reply after reply[0]
+// returns true to have it sent back under the same type.
+typedef uint8_t (*HidPacketHandler)(const uint8_t * packet, uint8_t * reply);
+
+// Sets the handler for a type, replacing any before. Types without one are
+// ignored. Version and legacy packets are handled here.
+void hid_protocol_register(HidPacketType, HidPacketHandler);
+
+// Version of the framing in use this session
+uint8_t hid_protocol_version();
+
+// Back to legacy framing, for when the host goes away
+void hid_protocol_reset();
+
+// Header byte for a packet of the given type to the host: the type itself
+// when typed, the matching PROFILE_*_PACKET value in a legacy session
+uint8_t hid_protocol_header(HidPacketType);
+
+// Sends the reply to a typed packet that the IN endpoint had no room for,
+// if there is one. Returns true once nothing is left waiting, so sensor
+// reports can hold off until then.
+uint8_t hid_protocol_send_pending();
+
+// Hands a packet from the host to its handler, or to led_frame
+void hid_protocol_dispatch(uint8_t * packet);
+
+// Fast path for hid_protocol_dispatch, from the USB interrupt. Only takes
+// LED segments, see led_frame_process_segment_isr. Returns 0, leaving the
+// packet untouched for the main loop, if it didn't take it.
+uint8_t hid_protocol_dispatch_isr(uint8_t * packet);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __LED_CODEC_H
+#define __LED_CODEC_H
+
+#include "stm32f3xx.h"
+
+// Decodes a bulk frame payload of the given format (LED_BULK_FORMAT_*, see
+// led_frame.h) into frame, a LED_ARRAY_SIZE buffer. Segment header bytes are
+// left alone. The payload is checked in full before frame is touched, so a
+// malformed payload leaves frame as it was. Returns 0 if it was malformed.
+uint8_t led_codec_decode(
+    uint8_t format, const uint8_t * payload, uint16_t len, uint8_t * frame);
+
+#endif
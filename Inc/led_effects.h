@@ -0,0 +1,46 @@
+#ifndef __LED_EFFECTS_H
+#define __LED_EFFECTS_H
+
+#include "stm32f3xx.h"
+
+// On-board lighting that reacts to presses without a round trip to the host:
+// each panel glows in the profile's colour while pressed, and fades out once
+// released. led_frame renders the effects into every frame it sends, and
+// sends frames of its own while they change.
+//
+// How they combine with frames from the host is set by the profile:
+//   Off:      host frames only
+//   Blend:    the glow is added on top of host frames
+//   Override: the glow only, host frames are kept but not shown
+//   Idle:     the glow only, while no host frame has come in for
+//             LED_EFFECTS_HOST_IDLE_MS, e.g. on a cabinet without the utility
+typedef enum {
+    LedEffects_Off = 0x0,
+    LedEffects_Blend = 0x1,
+    LedEffects_Override = 0x2,
+    LedEffects_Idle = 0x3,
+} LedEffectsMode;
+
+// Fades advance once per this many milliseconds, so this is also the
+// fastest the effects send frames of their own
+#define LED_EFFECTS_FRAME_MS (10U)
+
+#define LED_EFFECTS_HOST_IDLE_MS (1000U)
+
+// Loads the mode, glow colour and fade speed from profile data, laid out as
+// described in profile_config.h. Glows are reset.
+void led_effects_load_profile(const uint8_t * profile);
+
+// Whether the effects shape what the panels show, given whether the host
+// has gone quiet
+uint8_t led_effects_active(uint8_t host_idle);
+
+// Lights up panels that are pressed as of press_detect and fades the others.
+// Returns whether any glow changed, in which case the panels need a new frame.
+uint8_t led_effects_update();
+
+// Renders the effects into a frame laid out as in led_frame.h, on top of
+// what's in it already. Segment headers are left alone.
+void led_effects_apply(uint8_t * frame);
+
+#endif
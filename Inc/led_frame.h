@@ -0,0 +1,102 @@
+#ifndef __LED_FRAME_H
+#define __LED_FRAME_H
+
+#include "stm32f3xx.h"
+
+#define BYTES_PER_SEGMENT (64U)
+#define SEGMENTS_PER_PANEL (4U)
+#define BYTES_PER_PANEL (BYTES_PER_SEGMENT * SEGMENTS_PER_PANEL)
+#define PANELS_PER_PLATFORM (4U)
+#define LED_ARRAY_SIZE (BYTES_PER_PANEL * PANELS_PER_PLATFORM)
+
+#define COMPLETE_FRAME (0xFFFF)
+
+// Each segment is its header byte followed by 21 RGB pixels
+#define LED_SEGMENT_DATA_OFFSET (1U)
+#define LED_BYTES_PER_PIXEL (3U)
+#define LED_PIXELS_PER_SEGMENT ((BYTES_PER_SEGMENT - LED_SEGMENT_DATA_OFFSET) / LED_BYTES_PER_PIXEL)
+#define LED_PIXEL_COUNT (LED_PIXELS_PER_SEGMENT * SEGMENTS_PER_PANEL * PANELS_PER_PLATFORM)
+
+// Complete frames are committed to the panels either straight away, or at
+// the commit rate set in the profile, in both cases once the panels have
+// been sent the previous frame. Only the newest complete frame is committed;
+// any older one still waiting is dropped.
+//
+// Bulk frame transfers start with a small header:
+//   byte 0:    format of the payload, see LED_BULK_FORMAT_*
+//   byte 1:    frame number, for the host's own bookkeeping
+//   byte 2..3: payload length in bytes, little endian
+// followed by the payload. A raw payload is the whole LED_ARRAY_SIZE frame,
+// laid out exactly like the HID segments concatenated in panel then segment
+// order. The first byte of every segment is overwritten with the matching
+// HID segment header before it goes to the panels.
+//
+// The compressed formats work on the LED_PIXEL_COUNT pixels of a frame, in
+// the same order, and never carry segment headers:
+//   RLE:     runs of [count 1-255][r][g][b] covering every pixel
+//   Palette: [n 1-16][n x r,g,b] then one 4 bit palette index per pixel,
+//            two per byte with the lower nibble first
+//   Delta:   runs of [skip][count] followed by count x r,g,b values that are
+//            XORed onto the pixels after skipping the given number of them.
+//            Only accepted when the frame number directly follows that of
+//            the last bulk frame, which it is applied on top of.
+// A lost or rejected frame leaves every following delta frame rejected, so
+// hosts watch the rejected count in the telemetry and resync with a frame in
+// one of the other formats, as well as sending one every so often.
+#define LED_BULK_HEADER_SIZE (4U)
+#define LED_BULK_MAX_TRANSFER (LED_BULK_HEADER_SIZE + LED_ARRAY_SIZE)
+
+#define LED_BULK_FORMAT_RAW (0x00U)
+#define LED_BULK_FORMAT_RLE (0x01U)
+#define LED_BULK_FORMAT_PALETTE (0x02U)
+#define LED_BULK_FORMAT_DELTA (0x03U)
+#define LED_BULK_FORMAT_COUNT (4U)
+
+#define LED_PALETTE_MAX_COLORS (16U)
+
+// Loads the commit rate from profile data, laid out as described in
+// profile_config.h
+void led_frame_load_profile(const uint8_t * profile);
+
+// Paces frame commits, to be called from the USB SOF interrupt
+void led_frame_on_sof();
+
+// Commits the newest complete frame when the commit rate says it's time.
+// To be called every main loop iteration.
+void led_frame_task();
+
+// Takes one 64 byte HID packet holding a single segment of a frame.
+// Segments of two frames can be assembled side by side, keyed by frame id.
+// A frame is ready for commit once all segments of it have arrived, at
+// which point any older partial frame is dropped. Partial frames are also
+// dropped after a timeout, and segments of frames older than the last
+// complete one are ignored.
+void led_frame_process_segment(uint8_t * packet);
+
+// Fast path for led_frame_process_segment, called from the USB interrupt as
+// soon as the OUT transfer completes. Besides being stored, the segment is
+// sent to its panel straight away if the port is idle. A frame it completes
+// is left for led_frame_task to commit, with EVENT_LED posted to have it run.
+// Returns 0, leaving the packet for the main loop, if the main loop is
+// inside msgbus or this module.
+// Telling segments from other packets is up to the caller (hid_protocol).
+uint8_t led_frame_process_segment_isr(uint8_t * packet);
+
+// Takes one bulk transfer holding a whole frame in any of the formats above
+// and decodes it, after which it is ready for commit.
+// Returns 0 if the transfer was malformed or a delta frame had no base.
+uint8_t led_frame_process_bulk(const uint8_t * data, uint16_t len);
+
+// Counts a bulk transfer that was thrown away unseen as rejected, and stops
+// delta frames from building on the frame before it
+void led_frame_discard_bulk();
+
+// Frame number the next delta frame has to follow, returns 0 if delta
+// frames are rejected until a frame in another format arrives
+uint8_t led_frame_bulk_base(uint8_t * frame);
+
+// Bulk frames received and rejected since boot
+extern uint32_t led_bulk_frames_received;
+extern uint32_t led_bulk_frames_rejected;
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __LED_POST_H
+#define __LED_POST_H
+
+#include "stm32f3xx.h"
+
+// Post-processing applied to every frame just before its segments go to the
+// panels: brightness and gamma through one lookup table, then, if the frame
+// would draw more than the power budget, scaling all of it down to fit.
+// Frames are worked on a word at a time with the Cortex-M4 SIMD instructions.
+
+// Current drawn by one LED channel at full duty, in mA. A frame's draw is
+// estimated from the sum of its channel values.
+#define LED_POST_CHANNEL_MA (20U)
+
+// Power budget steps in the profile, in mA
+#define LED_POST_BUDGET_STEP_MA (100U)
+
+// Cycles the last frame took to process, and its estimated draw in mA
+// before the budget was applied
+extern uint32_t led_post_cycles;
+extern uint32_t led_post_current_ma;
+
+// Loads brightness, gamma and power budget from profile data, laid out as
+// described in profile_config.h
+void led_post_load_profile(const uint8_t * profile);
+
+// Whether the profile asks for any post-processing at all. Frames can go to
+// the panels untouched when it doesn't.
+uint8_t led_post_enabled();
+
+// Processes a frame laid out as in led_frame.h in place, leaving segment
+// headers alone. The frame must be word aligned.
+void led_post_process(uint8_t * frame);
+
+#endif
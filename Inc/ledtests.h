@@ -14,4 +14,6 @@ void ledtests_commit_LEDs(ComportId);
 
 void ledtests_loop_color_wheel(ComportId);
 
+void ledtests_color_benchmark();
+
 #endif
\ No newline at end of file
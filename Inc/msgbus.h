@@ -6,6 +6,7 @@
 #include "req_queue.h"
 #include "uart.h"
 #include "commands.h"
+#include "error_handler.h"
 
 #define MAX_REQUEST_DATA_BYTES (64U)
 #define MAX_RESPONSE_DATA_BYTES (64U)
@@ -26,6 +27,9 @@ typedef struct {
     // Number of bytes contained in the response; should be at least 1.
     // This number is copied from the Request struct that caused this response
     uint16_t data_length;
+
+    // Time (timebase_us) at which the receive completed, in the interrupt
+    uint32_t received_at;
 } Response;
 
 typedef enum {
@@ -81,11 +85,34 @@ typedef struct {
     // a response, we consider the request to have timed out.
     uint32_t waiting_since;
 
+    // Time (timebase_us) of the last receive complete interrupt
+    volatile uint32_t received_at;
+
     // Counts how many times this port has reached a timeout.
     // Only useful when using the debugger at the moment, could be useful
     // for more advanced recovery, perhaps?
     uint32_t timeout_count;
 
+    // Counts how many times this port was reset after a fault: a UART error,
+    // a missing acknowledge, a transfer that wouldn't start or a completion
+    // in the wrong state. The current request is dropped each time.
+    uint32_t fault_count;
+
+    // What the last fault was, and a detail of it, for the debugger
+    ErrorCode last_fault;
+    uint32_t last_fault_data;
+
+    // HAL_UART_ERROR_* bits of a UART error, set by the interrupt
+    volatile uint32_t uart_error;
+
+    // Counts requests dropped because the queue was full, or because the
+    // panel went away while they were queued (see msgbus_flush_port)
+    uint32_t queue_full_count;
+    uint32_t flushed_count;
+
+    // Counts requests that were acknowledged or answered
+    uint32_t completed_count;
+
     // Target of the "acknowledge" response byte, should be written to
     // the value of MSG_ACKNOWLEDGE by the uart to indicate receipt of a command
     // or additional data. Once read on this end, should be set back to 0x00.
@@ -123,6 +150,37 @@ Response * msgbus_get_pending_response();
 
 PortStatus msgbus_port_status(ComportId);
 
+// Whether a request sent to this port now would start straight away, rather
+// than wait in its queue
+uint8_t msgbus_port_ready(ComportId);
+
+// Whether main loop code is in the middle of a msgbus call. Interrupt
+// handlers must not send requests while it returns true.
+uint8_t msgbus_in_use();
+
+// Number of requests on this port that timed out waiting for the panel
+uint32_t msgbus_timeout_count(ComportId);
+
+// Number of times this port was reset after a fault, see PortState
+uint32_t msgbus_fault_count(ComportId);
+
+// Number of requests on this port that the panel acknowledged or answered
+uint32_t msgbus_completed_count(ComportId);
+
+// Number of requests on this port that will never complete: timed out,
+// dropped by a fault, turned away by a full queue or flushed. A request sent
+// earlier that hasn't been answered by the time this changes may have been
+// lost.
+uint32_t msgbus_dropped_count(ComportId);
+
+// Drops every request queued for a port, leaving the one in progress
+void msgbus_flush_port(ComportId);
+
+// Whether any request being worked on or queued, on any port, still has to
+// send data from the given memory range. Until it returns false the memory
+// must be left alone.
+uint8_t msgbus_sending_from(const uint8_t * data, uint16_t len);
+
 void msgbus_wait_for_idle(ComportId);
 
 void msgbus_switch_ports_if_done();
@@ -0,0 +1,47 @@
+#ifndef __PANEL_DETECT_H
+#define __PANEL_DETECT_H
+
+#include "stm32f3xx.h"
+#include "uart.h"
+
+// Works out at runtime which panels are plugged in and answering, and keeps
+// panel_connected() (config.h) up to date with it, so bus time only goes to
+// live panels. Panels set as connected in config.h are always taken to be.
+//
+// Every panel starts out probed at boot. Requests to a panel being probed go
+// out as usual, sensor polls in particular, and the first one to complete or
+// be lost (by timeout or fault, see msgbus.h) decides whether it's there.
+// A panel that's there is dropped after PANEL_DETECT_LOST_AFTER requests in
+// a row are lost. One that isn't is probed again after a backoff, doubling
+// from PANEL_DETECT_BACKOFF_MIN_MS up to PANEL_DETECT_BACKOFF_MAX_MS for as
+// long as it stays silent, which also finds panels plugged in later. A
+// panel raising its CK "initialized" line is probed straight away.
+typedef enum {
+    PanelDetect_Absent = 0x0,
+    PanelDetect_Probing = 0x1,
+    PanelDetect_Present = 0x2,
+} PanelDetectState;
+
+#define PANEL_DETECT_LOST_AFTER (3U)
+#define PANEL_DETECT_BACKOFF_MIN_MS (8U)
+#define PANEL_DETECT_BACKOFF_MAX_MS (1024U)
+
+// Starts probing every panel, or takes it as present if its CK line says
+// it's initialized. To be called once msgbus is set up.
+void panel_detect_init();
+
+// Follows requests completed and lost on every port, and probes panels whose
+// backoff is up. To be called every tick.
+void panel_detect_task();
+
+PanelDetectState panel_detect_state(ComportId);
+
+// One bit per port (by ComportId) for each panel found since the last call,
+// which need their settings sent again
+uint8_t panel_detect_take_found();
+
+// One bit per port for each panel lost since the last call, whose last
+// readings and presses no longer hold
+uint8_t panel_detect_take_lost();
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __PRESS_DETECT_H
+#define __PRESS_DETECT_H
+
+#include "stm32f3xx.h"
+#include "uart.h"
+#include "sensor_report.h"
+
+// Thresholds and hysteresis are stored as one byte each in the profile,
+// and are scaled up by this shift to compare against raw sensor readings.
+#define PRESS_THRESHOLD_SHIFT (4U)
+
+// Number of gamepad buttons panels can be mapped to
+#define PRESS_BUTTON_COUNT (16U)
+
+// Thresholds pushed to a panel with Command_Set_Thresholds: the press
+// threshold of each of its sensors followed by their release thresholds,
+// 16 bit little endian on the scale of raw readings. A press threshold of 0
+// disables the sensor.
+#define PRESS_PANEL_THRESHOLDS_LEN (SENSORS_PER_PANEL * 4U)
+
+// A panel answers Command_Request_Press_Mask with one byte, bit n set while
+// its sensor n is pressed by the thresholds it was given
+#define PRESS_MASK_RESPONSE_LEN (1U)
+
+// Loads thresholds, hysteresis and panel keys from profile data, laid out
+// as described in profile_config.h. Press state is reset.
+void press_detect_load_profile(const uint8_t * profile);
+
+// Evaluates a new set of readings from a panel, as received from a
+// sensor poll (SENSOR_RESPONSE_LEN bytes).
+void press_detect_update(ComportId, const uint8_t * data);
+
+// Takes a panel's press state as worked out by the panel itself, as
+// received from a press mask poll
+void press_detect_update_mask(ComportId, uint8_t mask);
+
+// Releases every sensor of a panel that stopped answering
+void press_detect_clear_panel(ComportId);
+
+// The thresholds to push to a panel (PRESS_PANEL_THRESHOLDS_LEN bytes), as
+// of the last profile loaded
+const uint8_t * press_detect_panel_thresholds(ComportId);
+
+// Where a press mask poll on the given port should have the panel write
+// its answer
+uint8_t * press_detect_mask_buffer(ComportId);
+
+// One bit per sensor, set while the sensor is pressed. Bit index is
+// panel * SENSORS_PER_PANEL + sensor.
+uint16_t press_detect_sensors();
+
+// One bit per panel (by ComportId), set while any of its sensors is pressed
+uint8_t press_detect_panels();
+
+// Gamepad button map, one bit per button, from the panels' keys
+uint16_t press_detect_buttons();
+
+#endif
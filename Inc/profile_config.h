@@ -3,25 +3,120 @@
 
 #include "eeprom_emul.h"
 #include <stdint.h>
+#include <stdbool.h>
+
+#define PROFILE_DATA_LEN (63U)
+
+// Profiles kept side by side, e.g. one per player or game mode
+#define PROFILE_SLOT_COUNT (4U)
+
+// Keys of the records in the config log (see eeprom_emul.h): one per slot,
+// starting at the key older firmware used for its only profile, and the
+// slot that's active
+#define PROFILE_CONFIG_KEY (0x01U)
+#define PROFILE_SLOT_KEY(slot) (PROFILE_CONFIG_KEY + (slot))
+#define PROFILE_ACTIVE_KEY (0x10U)
+
+// How long the active slot has to stay unchanged before it's saved, so a
+// run of switches costs a single write
+#define PROFILE_ACTIVE_SAVE_DELAY_MS (2000U)
+
+/* Layout of the profile data, as pushed by the host.
+ * Sensors are indexed panel by panel in ComportId order (left, down, up,
+ * right), SENSORS_PER_PANEL sensors per panel.
+ *
+ *  0..15  Press threshold per sensor, 0 disables the sensor
+ * 16..31  Release hysteresis per sensor
+ * 32..35  Key per panel
+ * 36..43  Filter type per sensor, two sensors per byte, even sensor in the
+ *         low nibble (see SensorFilterType)
+ * 44      EMA smoothing factor, in 1/256ths
+ * 45      Median filter window, 3 or 5 samples
+ * 46      Biquad low-pass cutoff, in 1/256ths of the sample rate
+ * 47      LED commit rate in frames per second, 0 commits every frame as
+ *         soon as it is complete
+ * 48      Sensor poll rate in kHz, 1, 2, 4 or 8. Anything else polls again
+ *         as soon as the bus has moved on.
+ * 49      Sensor report lead time before the host's expected IN token, in
+ *         10us units. 0 sends reports as soon as new data is in.
+ * 50      Full readings poll interval: one poll in this many fetches full
+ *         readings, the others a 1 byte press mask the panels work out from
+ *         the thresholds pushed to them. 0 or 1 always fetches full readings
+ *         and pushes no thresholds, for panels without press masks.
+ * 51      LED effects mode, see LedEffectsMode
+ * 52..54  LED effects glow colour, red, green and blue
+ * 55      LED effects fade, how much of 255 a released panel's glow drops
+ *         every LED_EFFECTS_FRAME_MS. 0 switches it off straight away.
+ * 56      LED brightness in 1/256ths, 0 for full brightness
+ * 57      LED gamma correction, 1 for on (see color_gamma), 0 for off
+ * 58      LED power budget in LED_POST_BUDGET_STEP_MA steps, 0 for none.
+ *         Frames estimated to draw more are dimmed to fit.
+ * 59..62  Unused
+ */
+#define PROFILE_THRESHOLDS_OFFSET  (0U)
+#define PROFILE_HYSTERESIS_OFFSET  (16U)
+#define PROFILE_PANEL_KEYS_OFFSET  (32U)
+#define PROFILE_FILTER_TYPES_OFFSET (36U)
+#define PROFILE_FILTER_EMA_OFFSET (44U)
+#define PROFILE_FILTER_MEDIAN_OFFSET (45U)
+#define PROFILE_FILTER_BIQUAD_OFFSET (46U)
+#define PROFILE_LED_COMMIT_RATE_OFFSET (47U)
+#define PROFILE_SENSOR_POLL_RATE_OFFSET (48U)
+#define PROFILE_SENSOR_REPORT_LEAD_OFFSET (49U)
+#define PROFILE_SENSOR_FULL_POLL_OFFSET (50U)
+#define PROFILE_LED_EFFECTS_MODE_OFFSET (51U)
+#define PROFILE_LED_EFFECTS_COLOR_OFFSET (52U)
+#define PROFILE_LED_EFFECTS_FADE_OFFSET (55U)
+#define PROFILE_LED_BRIGHTNESS_OFFSET (56U)
+#define PROFILE_LED_GAMMA_OFFSET (57U)
+#define PROFILE_LED_POWER_BUDGET_OFFSET (58U)
 
 /**
-  * @brief  Saves the profile configuration.
+  * @brief  Reads every slot's profile and the active slot from flash into RAM.
+  *         A slot without a valid record gets the default profile, except
+  *         slot 0 which first tries a profile saved by older firmware (a
+  *         64-byte slot with checksum). To be called once at boot.
+  */
+void profile_config_init(void);
+
+/**
+  * @brief  Updates a slot's profile and queues it to be saved.
   *         The caller provides a pointer to 63 bytes (e.g. usb_buffer + 1).
-  *         A checksum is computed and appended as the 64th byte.
+  *         They are copied and appended to the config log as a record, which
+  *         carries its own CRC, by epemul_task in the background.
   *
+  * @param  slot: Slot to save to, below PROFILE_SLOT_COUNT.
   * @param  data: Pointer to 63 bytes of configuration data.
-  * @retval HAL status.
+  * @param  done: Called once the profile is in flash, may be NULL.
+  * @retval HAL status, HAL_BUSY if too many saves are still queued.
+  */
+HAL_StatusTypeDef profile_config_save(uint8_t slot, const uint8_t *data, EpemulWriteDone done);
+
+/**
+  * @brief  Returns a slot's profile, 63 bytes, from RAM.
   */
-HAL_StatusTypeDef profile_config_save(const uint8_t *data);
+const uint8_t *profile_config_get(uint8_t slot);
 
 /**
-  * @brief  Reads the profile configuration.
-  *         The stored 64-byte slot is read; the checksum is recalculated and verified.
-  *         If the checksum is valid, the first 63 bytes are returned.
-  *         Otherwise, a default 63-byte packet is copied.
+  * @brief  Returns the active slot's profile, 63 bytes, from RAM.
+  */
+const uint8_t *profile_config_active(void);
+
+uint8_t profile_config_active_slot(void);
+
+/**
+  * @brief  Makes a slot the active one, without touching flash. The choice
+  *         is saved by profile_config_task once it has settled.
+  *         Apply profile_config_active() afterwards.
   *
-  * @param  data: Pointer to a 63-byte buffer where the configuration will be stored.
+  * @retval false if there is no such slot.
+  */
+bool profile_config_switch(uint8_t slot);
+
+/**
+  * @brief  Queues the active slot to be saved once it has been left alone
+  *         for PROFILE_ACTIVE_SAVE_DELAY_MS. To be called regularly.
   */
-void profile_config_read(uint8_t *data);
+void profile_config_task(void);
 
 #endif /* PROFILE_CONFIG_H */
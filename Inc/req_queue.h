@@ -12,7 +12,9 @@ typedef struct {
     uint8_t count;
 } RequestQueue;
 
-void req_queue_add(RequestQueue *, Request);
+// Adds a request unless an equal one is queued already. Returns false if the
+// queue was full, in which case the request is dropped.
+uint8_t req_queue_add(RequestQueue *, Request);
 Request req_queue_take(RequestQueue *);
 void req_queue_init(RequestQueue *);
 
@@ -0,0 +1,28 @@
+#ifndef __SENSOR_FILTER_H
+#define __SENSOR_FILTER_H
+
+#include "stm32f3xx.h"
+#include "uart.h"
+
+typedef enum {
+    SensorFilter_None = 0x0,
+    // Exponential moving average
+    SensorFilter_EMA = 0x1,
+    // Median of the last 3 or 5 samples
+    SensorFilter_Median = 0x2,
+    // Second order (biquad) Butterworth low-pass
+    SensorFilter_Biquad = 0x3
+} SensorFilterType;
+
+// Largest median window supported
+#define SENSOR_FILTER_MEDIAN_MAX (5U)
+
+// Loads filter types and parameters from profile data, laid out as described
+// in profile_config.h. Filter state is reset.
+void sensor_filter_load_profile(const uint8_t * profile);
+
+// Filters a new set of readings from a panel in place. data is in the format
+// of a sensor poll response (SENSOR_RESPONSE_LEN bytes).
+void sensor_filter_apply(ComportId, uint8_t * data);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __SENSOR_POLL_H
+#define __SENSOR_POLL_H
+
+#include "stm32f3xx.h"
+#include "uart.h"
+
+// Paces sensor polls with TIM6, at a rate set by the profile. Without a
+// rate the panels are polled again as soon as the bus has moved on, as fast
+// as the main loop goes.
+
+// Poll rates the profile can select, in kHz. Any other value free-runs.
+#define SENSOR_POLL_RATES_KHZ { 1U, 2U, 4U, 8U }
+
+// Loads the poll rate from profile data, laid out as described in
+// profile_config.h, and starts or stops the poll timer to match
+void sensor_poll_load_profile(const uint8_t * profile);
+
+// Whether polls are issued whenever the bus has moved on, rather than by
+// the poll timer
+uint8_t sensor_poll_free_running();
+
+// To be called once for every EVENT_POLL taken by the main loop, before
+// sensor_poll_start. Accounts for timer ticks that went by unhandled.
+void sensor_poll_begin();
+
+// Whether a poll should be sent to the port on this tick. Returns false,
+// counting an overrun, while the port's previous poll is unanswered.
+// A true return counts the poll as issued.
+uint8_t sensor_poll_start(ComportId);
+
+// Whether the profile has any press mask polls sent at all, which is what
+// the panels need thresholds for. Panels that predate them only get full
+// polls otherwise.
+uint8_t sensor_poll_uses_press_masks();
+
+// Whether the next poll of the port should fetch full readings, rather
+// than a press mask. The profile sets how many polls in a row can be press
+// mask polls (see profile_config.h).
+uint8_t sensor_poll_next_is_full(ComportId);
+
+// Responses per second the port managed over the last measuring window
+uint32_t sensor_poll_rate_achieved(ComportId);
+
+// To be called for every sensor or press mask response received from a
+// port, with whether it was full readings
+void sensor_poll_answered(ComportId, uint8_t full);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __SENSOR_REPORT_H
+#define __SENSOR_REPORT_H
+
+#include "stm32f3xx.h"
+#include "uart.h"
+#include "msgbus.h"
+
+#define SENSOR_REPORT_SIZE (64U)
+
+// Each panel has SENSORS_PER_PANEL sensors, and answers a poll with one
+// 16 bit little endian reading per sensor.
+#define SENSORS_PER_PANEL (4U)
+#define SENSOR_PANEL_COUNT (COMPORT_ID_MAX + 1)
+#define SENSOR_COUNT (SENSORS_PER_PANEL * SENSOR_PANEL_COUNT)
+#define SENSOR_RESPONSE_LEN (SENSORS_PER_PANEL * 2U)
+
+// Layout of the 64 byte sensor report sent to the host. All multi-byte
+// values are little endian. Times are in microseconds of the device clock.
+//
+//  0..31  Raw sensor data, SENSOR_RESPONSE_LEN bytes per panel, in ComportId
+//         order (left, down, up, right)
+// 32..35  Report sequence number, incremented for every report queued
+// 36..39  Device time at which the report was queued for the IN endpoint
+// 40..41  USB frame number of the most recent SOF at that time
+// 42..43  Time between that SOF and queueing the report
+// 44..51  Per-panel sample age: time between the panel's data (full
+//         readings or press mask) arriving and queueing the report.
+//         Saturates at 0xFFFF, which also means the panel hasn't responded
+//         yet or was lost.
+// 52..53  Pressed sensors, one bit per sensor in the order of the raw data.
+//         Kept up to date by press mask polls between full readings.
+// 54..63  Reserved, zero
+//
+// In a typed HID session (see hid_protocol.h) the report is preceded by its
+// type byte, and the last reserved byte is left off.
+#define SENSOR_REPORT_DATA_OFFSET (0U)
+#define SENSOR_REPORT_SEQUENCE_OFFSET (32U)
+#define SENSOR_REPORT_TIMESTAMP_OFFSET (36U)
+#define SENSOR_REPORT_SOF_FRAME_OFFSET (40U)
+#define SENSOR_REPORT_SOF_OFFSET_OFFSET (42U)
+#define SENSOR_REPORT_AGE_OFFSET (44U)
+#define SENSOR_REPORT_PRESSED_OFFSET (52U)
+
+#define SENSOR_REPORT_AGE_UNKNOWN (0xFFFFU)
+
+// The report as it will be sent next, public for inspection while debugging.
+// Only the sensor data section is kept up to date between reports.
+extern uint8_t usb_sensor_buffer[SENSOR_REPORT_SIZE];
+
+// Where a poll on the given port should have the panel write its data
+uint8_t * sensor_report_poll_buffer(ComportId);
+
+// Copies a sensor response into the report and remembers when it arrived
+void sensor_report_store(Response *);
+
+// Remembers when a press mask response arrived. The mask itself reaches the
+// report through press_detect.
+void sensor_report_store_mask(Response *);
+
+// Zeroes a lost panel's data in the report and marks its age unknown
+void sensor_report_clear_panel(ComportId);
+
+// Stamps the report and queues it on the IN endpoint, if the endpoint is free.
+// Returns whether the report was queued.
+uint8_t sensor_report_send();
+
+// Reports can be held back until just before the host's IN token, so they
+// carry the newest data the host could get in that frame. The token's time
+// after SOF is learnt from when IN transfers complete. Every SOF then sets
+// an alarm the profile's lead time before it, which posts EVENT_REPORT.
+// Reports that still miss their token make the lead grow, and it shrinks
+// back slowly while they don't.
+
+// Loads the report lead time from profile data, laid out as described in
+// profile_config.h
+void sensor_report_load_profile(const uint8_t * profile);
+
+// Whether reports wait for EVENT_REPORT, rather than go as soon as new data
+// is in
+uint8_t sensor_report_aligned();
+
+// To be called from the USB interrupt on every SOF
+void sensor_report_on_sof();
+
+// To be called from the USB interrupt when a transfer on the IN endpoint
+// completes
+void sensor_report_on_sent();
+
+#endif
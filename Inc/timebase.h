@@ -0,0 +1,34 @@
+#ifndef __TIMEBASE_H
+#define __TIMEBASE_H
+
+#include "stm32f3xx.h"
+
+// Free-running clocks used for timestamping and cycle measurements.
+//
+// The microsecond clock runs from TIM2 (a 32 bit timer on this part), so it
+// wraps every ~71 minutes. Always compare timestamps by subtracting them as
+// uint32_t, never with < or >.
+// The cycle clock is the DWT cycle counter, which wraps every ~60 seconds at
+// 72MHz. It's meant for measuring short sections of code.
+
+typedef void (* AlarmHandler)(void);
+
+// Starts both clocks. Must be called after the system clock is configured.
+void timebase_init();
+
+// Has the handler called once the microsecond clock reaches the given time,
+// from the TIM2 interrupt. A time already passed calls it straight away.
+// Only one alarm can be set at a time; setting another replaces it.
+void timebase_set_alarm(uint32_t at, AlarmHandler handler);
+
+// Current time in microseconds
+static inline uint32_t timebase_us() {
+    return TIM2->CNT;
+}
+
+// Current core cycle count
+static inline uint32_t timebase_cycles() {
+    return DWT->CYCCNT;
+}
+
+#endif
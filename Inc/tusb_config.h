@@ -74,15 +74,19 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID             1
+#define CFG_TUD_HID             2 // Sensor/LED data, gamepad
 #define CFG_TUD_CDC             0
 #define CFG_TUD_MSC             0
 #define CFG_TUD_MIDI            0
-#define CFG_TUD_VENDOR          0
+#define CFG_TUD_VENDOR          1 // Bulk LED frames
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_BUFSIZE     64U
 
+// Vendor receive buffer, large enough for a whole bulk LED frame:
+// 4 byte header + 1024 bytes of LED data
+#define CFG_TUD_VENDOR_RX_BUFSIZE 1028U
+
 #ifdef __cplusplus
  }
 #endif
@@ -3,6 +3,19 @@
 
 #define USB_SEND_REPORT_ID (0)
 
+// HID interfaces, in configuration descriptor order
+#define USB_HID_INSTANCE_DATA (0U)
+#define USB_HID_INSTANCE_GAMEPAD (1U)
+
+// Endpoints of the data interface
+#define USB_HID_DATA_EP_IN (0x81U)
+#define USB_HID_DATA_EP_OUT (0x01U)
+
+// Oldest packet received from the host and not yet consumed, or NULL if
+// there is none. The packet stays valid until usb_consume_packet is called.
 uint8_t * usb_get_packet();
 
+// Releases the packet returned by usb_get_packet
+void usb_consume_packet();
+
 #endif
\ No newline at end of file
@@ -19,6 +19,7 @@ typedef enum {
 
 typedef void (* SendCompleteHandler)(ComportId);
 typedef void (* ReceiveCompleteHandler)(ComportId);
+typedef void (* PortErrorHandler)(ComportId, uint32_t error);
 
 // Initializes uart functionality
 void uart_init();
@@ -26,20 +27,32 @@ void uart_init();
 // Ensures a given port is electrically connected to a UART peripheral
 void uart_connect_port(ComportId);
 
+// Whether the panel on a port is holding its CK line high, which panel
+// boards do once they're initialized
+uint8_t uart_panel_initialized(ComportId);
+
 // Begins sending data to a given comport
 // data_ptr points to the start of an array of data to be sent,
 // data_len is the number of bytes to be sent
-void uart_send(
+// Anything but HAL_OK means the transfer didn't start
+HAL_StatusTypeDef uart_send(
     ComportId comport_id, uint8_t * data_ptr, uint16_t data_len);
 
 // Begins receiving on a given comport
 // data_ptr points to the start of an array where received data will be stored
 // data_len is the number of bytes we expect to receive
-void uart_receive(
+// Anything but HAL_OK means the transfer didn't start
+HAL_StatusTypeDef uart_receive(
     ComportId comport_id, uint8_t * data_ptr, uint16_t data_len);
 
 void uart_abort_receive(ComportId comport_id);
 
+// Gets a port going again after a fault: stops both of its DMA transfers,
+// then clears the USART's error flags and whatever is left in its receive
+// register. Other ports carry on undisturbed. Up and right share USART2,
+// which is left alone unless the port given is the one connected to it.
+void uart_reset_port(ComportId comport_id);
+
 // Configures a callback function to be called when a transmission completes
 // The handler function will be passed the ComportId of the port that finished
 // transmitting
@@ -50,4 +63,10 @@ void uart_set_on_send_complete_handler(SendCompleteHandler);
 // finished receiving
 void uart_set_on_receive_complete_handler(ReceiveCompleteHandler);
 
+// Configures a callback function to be called when a port has an overrun,
+// framing, noise, parity or DMA error, from the interrupt. The handler is
+// passed the port and the HAL_UART_ERROR_* bits. The port's receive has
+// been stopped by then, and needs uart_reset_port.
+void uart_set_on_error_handler(PortErrorHandler);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef __USB_SOF_H
+#define __USB_SOF_H
+
+#include "stm32f3xx.h"
+
+// Tracks USB Start-of-Frame timing. The host sends an SOF every 1ms, and
+// interrupt endpoints are serviced relative to it, so it's the reference
+// clock for anything that wants to line up with host polling.
+
+// Frame number (11 bits) of the most recent SOF
+uint16_t usb_sof_frame();
+
+// Time (timebase_us) at which the most recent SOF was seen
+uint32_t usb_sof_timestamp();
+
+#endif
@@ -2,6 +2,36 @@
 
 static double hue_to_rgb(double, double, double);
 
+// x / 255, rounded, for x up to 65535
+static inline uint8_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Percent in 0 to 100 to 0 to 255
+static inline uint8_t percent_to_8bit(uint8_t percent) {
+    return (percent * 255U + 50U) / 100U;
+}
+
+// Fully saturated colour for a hue, between two of the table's entries
+static inline uint8_t hue_channel(uint8_t from, uint8_t to, uint8_t fraction) {
+    return (from * (256U - fraction) + to * fraction) >> 8;
+}
+
+// Lightness applied to one channel of a fully saturated colour: black at 0,
+// the colour itself at 128 and white at 255
+static inline uint8_t lightness_channel(uint8_t pure, uint8_t lightness) {
+    if (lightness < 128) return div255(pure * (lightness * 2U));
+
+    return pure + div255((255U - pure) * (lightness * 2U - 255U));
+}
+
+// Saturation applied to one channel, mixing towards grey
+static inline uint8_t saturation_channel(
+    uint8_t full, uint8_t grey, uint8_t saturation) {
+    return div255(full * saturation + grey * (255U - saturation));
+}
+
 // This and hue_to_rgb taken from:
 // https://stackoverflow.com/a/9493060
 Color_RGB color_hsl_to_rgb(Color_HSL hsl) {
@@ -48,4 +78,47 @@ static double hue_to_rgb(double p, double q, double t) {
     if (t < 1.0 / 2.0) return q;
     if (t < 2.0 / 3.0) return p + (q - p) * (2.0 / 3.0 - t) * 6.0;
     return p;
-}
\ No newline at end of file
+}
+
+Color_RGB color_hsl_to_rgb_fixed(Color_HSL hsl) {
+    Color_HSL8 hsl8;
+
+    hsl.hue = hsl.hue > 360 ? 360 : hsl.hue;
+    hsl.saturation = hsl.saturation > 100 ? 100 : hsl.saturation;
+    hsl.lightness = hsl.lightness > 100 ? 100 : hsl.lightness;
+
+    // 360 degrees wraps around to 0, the same colour
+    hsl8.hue = ((uint32_t)hsl.hue * 65536U + 180U) / 360U;
+    hsl8.saturation = percent_to_8bit(hsl.saturation);
+    hsl8.lightness = percent_to_8bit(hsl.lightness);
+
+    return color_hsl8_to_rgb(hsl8);
+}
+
+Color_RGB color_hsl8_to_rgb(Color_HSL8 hsl) {
+    const Color_RGB * from = &color_hue_table[hsl.hue >> 8];
+    const Color_RGB * to = from + 1;
+    uint8_t fraction = hsl.hue & 0xFF;
+    uint8_t l = hsl.lightness;
+    uint8_t s = hsl.saturation;
+    Color_RGB rgb;
+
+    rgb.red = hue_channel(from->red, to->red, fraction);
+    rgb.green = hue_channel(from->green, to->green, fraction);
+    rgb.blue = hue_channel(from->blue, to->blue, fraction);
+
+    rgb.red = saturation_channel(lightness_channel(rgb.red, l), l, s);
+    rgb.green = saturation_channel(lightness_channel(rgb.green, l), l, s);
+    rgb.blue = saturation_channel(lightness_channel(rgb.blue, l), l, s);
+
+    return rgb;
+}
+
+void color_correct_pixels(uint8_t * rgb, uint16_t pixel_count, uint8_t brightness) {
+    uint16_t factor = brightness + 1;
+    uint8_t * end = rgb + pixel_count * 3U;
+
+    for (; rgb < end; rgb++) {
+        *rgb = (color_gamma_table[*rgb] * factor) >> 8;
+    }
+}
@@ -42,10 +42,12 @@ void set_config_mode(config_modes_t mode) {
 }
 
 config_modes_t packet_filter_for_config_mode(const uint8_t *packet) {
-    if (memcmp(packet, enter_config_magic, 64) == 0) {
+    // Every packet comes through here, so the first byte rules out nearly
+    // all of them before a full compare
+    if (packet[0] == enter_config_magic[0] && memcmp(packet, enter_config_magic, 64) == 0) {
         return CONFIG_MODE_ENTER;
     }
-    if (memcmp(packet, exit_config_magic, 64) == 0) {
+    if (packet[0] == exit_config_magic[0] && memcmp(packet, exit_config_magic, 64) == 0) {
         return CONFIG_MODE_EXIT;
     }
     return CONFIG_MODE_NORMAL;
@@ -1,34 +1,394 @@
 /* eeprom_emul.c - EEPROM emulation for configuration data on STM32F303 (single flash bank)
  *
  * This file is designed for STM32F303 devices (e.g., STM32F303CCT6) which have only one flash bank.
- * It reserves one 2-KB flash page for storing configuration data.
+ * It reserves two 2-KB flash pages for storing configuration data, as a log of records.
+ *
+ * Page layout:
+ *   page header   8 bytes: magic, generation
+ *   records       one after the other, each a record header followed by its
+ *                 data, padded to a multiple of 8 bytes
+ *   free space    erased (0xFF)
+ *
+ * Record header, 8 bytes: key, reserved, length (16 bit), CRC-16 over key,
+ * length and data, marker. Saving appends a record, and reading returns the
+ * newest valid one for a key. A record cut short by a reset fails its CRC
+ * and is skipped.
+ *
+ * Only when a page is full is the other page erased and the newest record of
+ * every key copied over. Its page header, with the next generation, is
+ * written last, so the old page stays in use until the copy is complete.
+ *
+ * Writes are queued and carried out by epemul_task a few doublewords at a
+ * time, so the main loop keeps running while a record goes into flash. A
+ * page erase is started through the flash interrupt, which posts EVENT_FLASH
+ * once it's done. Reads see queued records as the newest ones.
  *
  * NOTE:
- *  - The reserved flash area (CONFIG_START_ADDR to CONFIG_END_ADDR) must be excluded from your application code.
+ *  - The reserved flash area (CONFIG_LOG_PAGE_A to the end of CONFIG_LOG_PAGE_B) must be excluded from your application code.
  *  - Flash erase operations work on an entire page. Use sparingly!!
  */
 
 #include "eeprom_emul.h"
+#include "events.h"
 #include <string.h>  // for memcpy and memcmp
 
-/* 
- * Set up the erase structure for one page in FLASH_BANK_1.
- * The page number is calculated relative to the start of flash (0x08000000).
- */
-FLASH_EraseInitTypeDef erase = {
-    .TypeErase = FLASH_TYPEERASE_PAGES,
-    .PageAddress = CONFIG_START_ADDR,
-    .NbPages = 1
-};
+#define PAGE_MAGIC          0x4C474643U     // "CFGL"
+#define PAGE_HEADER_SIZE    8U
+#define RECORD_HEADER_SIZE  8U
+#define RECORD_MARKER       0xA55AU
+
+// Doublewords programmed per call of epemul_task. Each stalls the core for
+// around 200us, as code can't be fetched from flash while it's programmed.
+#define DOUBLEWORDS_PER_STEP 2U
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+} PageHeader;
+
+typedef struct {
+    uint8_t key;
+    uint8_t reserved;
+    uint16_t len;
+    uint16_t crc;
+    uint16_t marker;
+} RecordHeader;
+
+typedef enum {
+    Job_Idle,       // Nothing started, the next queued record is up
+    Job_Erase,      // Waiting for the flash interrupt to end the page erase
+    Job_Copy,       // Copying the newest records from the old page
+    Job_Record,     // Programming the queued record
+    Job_PageHeader, // Programming the header that makes the new page active
+} JobState;
+
+typedef struct {
+    uint8_t key;
+    uint16_t len;
+    EpemulWriteDone done;
+    // Record header and data, padded as they go into flash
+    uint8_t image[RECORD_HEADER_SIZE + EPEMUL_QUEUE_RECORD_MAX];
+} QueuedRecord;
+
+static QueuedRecord queue[EPEMUL_QUEUE_LENGTH];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+
+static struct {
+    JobState state;
+    uint32_t page;          // Page being written to
+    uint32_t old_page;      // Page being compacted from, 0 when appending
+    uint32_t addr;          // Next address to program
+    uint32_t scan;          // Next record on the old page to consider copying
+    const uint8_t *src;     // Bytes still to be programmed at addr
+    uint32_t remaining;
+    uint32_t keys_seen[256 / 32];
+    PageHeader header;
+} job;
+
+static volatile uint8_t erase_pending = 0;
+static volatile uint8_t erase_failed = 0;
 
 uint32_t fault = 0;
 
+/* Records cut short or corrupted, page compactions and writes that found
+ * the queue full, for inspection while debugging */
+uint32_t epemul_bad_records = 0;
+uint32_t epemul_compactions = 0;
+uint32_t epemul_queue_full = 0;
+
+static inline uint32_t record_size(uint16_t len)
+{
+    return RECORD_HEADER_SIZE + ((len + 7U) & ~7U);
+}
+
+static inline uint32_t other_page(uint32_t page)
+{
+    return page == CONFIG_LOG_PAGE_A ? CONFIG_LOG_PAGE_B : CONFIG_LOG_PAGE_A;
+}
+
+static inline uint8_t doubleword_blank(uint32_t addr)
+{
+    return *(__IO uint32_t*)addr == 0xFFFFFFFF && *(__IO uint32_t*)(addr + 4) == 0xFFFFFFFF;
+}
+
+/* CRC-16/CCITT, continuing from crc */
+static uint16_t crc16(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t record_crc(uint8_t key, uint16_t len, const uint8_t *data)
+{
+    uint8_t head[3] = { key, len & 0xFF, len >> 8 };
+    return crc16(crc16(0xFFFF, head, sizeof(head)), data, len);
+}
+
+static inline uint8_t page_valid(uint32_t page)
+{
+    return ((const PageHeader*)page)->magic == PAGE_MAGIC;
+}
+
+/* The page in use: the valid one with the newer generation, or 0 if neither is valid */
+static uint32_t active_page(void)
+{
+    uint8_t a_valid = page_valid(CONFIG_LOG_PAGE_A);
+    uint8_t b_valid = page_valid(CONFIG_LOG_PAGE_B);
+
+    if (a_valid && b_valid) {
+        uint32_t a_gen = ((const PageHeader*)CONFIG_LOG_PAGE_A)->generation;
+        uint32_t b_gen = ((const PageHeader*)CONFIG_LOG_PAGE_B)->generation;
+        return (int32_t)(b_gen - a_gen) > 0 ? CONFIG_LOG_PAGE_B : CONFIG_LOG_PAGE_A;
+    }
+
+    if (a_valid) return CONFIG_LOG_PAGE_A;
+    if (b_valid) return CONFIG_LOG_PAGE_B;
+    return 0;
+}
+
+/* Whether a record header was fully written and its record fits on the page */
+static inline uint8_t header_ok(uint32_t addr, uint32_t page)
+{
+    const RecordHeader *header = (const RecordHeader*)addr;
+    return header->marker == RECORD_MARKER
+        && header->len > 0
+        && addr + record_size(header->len) <= page + CONFIG_PAGE_SIZE;
+}
+
+static inline uint8_t record_valid(uint32_t addr)
+{
+    const RecordHeader *header = (const RecordHeader*)addr;
+    const uint8_t *data = (const uint8_t*)(addr + RECORD_HEADER_SIZE);
+    return header->crc == record_crc(header->key, header->len, data);
+}
+
+/*
+ * Address after the last record of a page, where the next one goes. Returns
+ * 0 if the page holds a header that was cut short, since the records after
+ * it can't be found and nothing more can be appended.
+ */
+static uint32_t log_end(uint32_t page)
+{
+    uint32_t addr = page + PAGE_HEADER_SIZE;
+
+    while (addr + RECORD_HEADER_SIZE <= page + CONFIG_PAGE_SIZE) {
+        if (doubleword_blank(addr)) return addr;
+        if (!header_ok(addr, page)) return 0;
+        addr += record_size(((const RecordHeader*)addr)->len);
+    }
+
+    return addr;
+}
+
+/* Address of the last record for the key on a page before limit, or 0 */
+static uint32_t last_record(uint32_t page, uint8_t key, uint32_t limit)
+{
+    uint32_t addr = page + PAGE_HEADER_SIZE;
+    uint32_t found = 0;
+
+    while (addr < limit && addr + RECORD_HEADER_SIZE <= page + CONFIG_PAGE_SIZE
+           && !doubleword_blank(addr) && header_ok(addr, page)) {
+        const RecordHeader *header = (const RecordHeader*)addr;
+
+        if (header->key == key) {
+            found = addr;
+        }
+
+        addr += record_size(header->len);
+    }
+
+    return found;
+}
+
+/* Address of the newest valid record for the key on a page, or 0. Only the
+ * newest records are checked against their CRC, so this stays cheap however
+ * many older ones the page holds. */
+static uint32_t find_record(uint32_t page, uint8_t key)
+{
+    uint32_t limit = page + CONFIG_PAGE_SIZE;
+    uint32_t found;
+
+    while ((found = last_record(page, key, limit)) != 0) {
+        if (record_valid(found)) {
+            return found;
+        }
+
+        epemul_bad_records++;
+        limit = found;
+    }
+
+    return 0;
+}
+
+/* Lays out a record as it goes into flash: header, data, erased padding */
+static void build_image(QueuedRecord *record, uint8_t key, const uint8_t *data, uint16_t len)
+{
+    RecordHeader header = {
+        .key = key,
+        .reserved = 0xFF,
+        .len = len,
+        .crc = record_crc(key, len, data),
+        .marker = RECORD_MARKER,
+    };
+
+    record->key = key;
+    record->len = len;
+    memset(record->image, 0xFF, sizeof(record->image));
+    memcpy(record->image, &header, RECORD_HEADER_SIZE);
+    memcpy(record->image + RECORD_HEADER_SIZE, data, len);
+}
+
+static inline void program_from(const uint8_t *src, uint32_t len)
+{
+    job.src = src;
+    job.remaining = len;
+}
+
+static void finish_job(HAL_StatusTypeDef status)
+{
+    QueuedRecord *record = &queue[queue_head];
+
+    job.state = Job_Idle;
+    queue_head = (queue_head + 1) % EPEMUL_QUEUE_LENGTH;
+    queue_count--;
+
+    if (record->done != NULL) {
+        record->done(record->key, status);
+    }
+}
+
+/* Appends the queued record to the active page, or starts moving the log to
+ * the other page if it doesn't fit */
+static void start_job(void)
+{
+    QueuedRecord *record = &queue[queue_head];
+    uint32_t page = active_page();
+
+    if (page != 0) {
+        // If the newest record already contains the new data, no update is necessary.
+        uint32_t found = find_record(page, record->key);
+        if (found != 0
+            && ((const RecordHeader*)found)->len == record->len
+            && memcmp((const uint8_t*)found, record->image, RECORD_HEADER_SIZE + record->len) == 0) {
+            finish_job(HAL_OK);
+            return;
+        }
+
+        uint32_t end = log_end(page);
+        if (end != 0 && end + record_size(record->len) <= page + CONFIG_PAGE_SIZE) {
+            job.page = page;
+            job.old_page = 0;
+            job.addr = end;
+            program_from(record->image, record_size(record->len));
+            job.state = Job_Record;
+            return;
+        }
+    }
+
+    job.old_page = page;
+    job.page = page != 0 ? other_page(page) : CONFIG_LOG_PAGE_A;
+    job.header.magic = PAGE_MAGIC;
+    job.header.generation = page != 0 ? ((const PageHeader*)page)->generation + 1 : 1;
+    job.addr = job.page + PAGE_HEADER_SIZE;
+    job.scan = page != 0 ? page + PAGE_HEADER_SIZE : 0;
+    job.remaining = 0;
+    memset(job.keys_seen, 0, sizeof(job.keys_seen));
+    job.keys_seen[record->key / 32] |= 1U << (record->key % 32);
+
+    epemul_compactions++;
+
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase = FLASH_TYPEERASE_PAGES,
+        .PageAddress = job.page,
+        .NbPages = 1
+    };
+
+    erase_pending = 1;
+    erase_failed = 0;
+    HAL_FLASH_Unlock();
+    if (HAL_FLASHEx_Erase_IT(&erase) != HAL_OK) {
+        erase_pending = 0;
+        HAL_FLASH_Lock();
+        finish_job(HAL_ERROR);
+        return;
+    }
+
+    job.state = Job_Erase;
+}
+
+/* Sets up the copy of the next record the new page needs from the old one.
+ * Returns 0 once there are none left. */
+static uint8_t next_copy(void)
+{
+    uint32_t old_page = job.old_page;
+
+    while (job.scan != 0
+           && job.scan + RECORD_HEADER_SIZE <= old_page + CONFIG_PAGE_SIZE
+           && !doubleword_blank(job.scan) && header_ok(job.scan, old_page)) {
+        uint8_t key = ((const RecordHeader*)job.scan)->key;
+        job.scan += record_size(((const RecordHeader*)job.scan)->len);
+
+        if (job.keys_seen[key / 32] & (1U << (key % 32))) continue;
+        job.keys_seen[key / 32] |= 1U << (key % 32);
+
+        uint32_t newest = find_record(old_page, key);
+        if (newest == 0) continue;
+
+        // Header and padding included, the record is copied as it is
+        program_from((const uint8_t*)newest, record_size(((const RecordHeader*)newest)->len));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Moves the job on to whatever comes after the bytes it just programmed */
+static void advance_job(void)
+{
+    QueuedRecord *record = &queue[queue_head];
+
+    switch (job.state) {
+        case Job_Copy:
+            if (next_copy()) break;
+            job.state = Job_Record;
+            program_from(record->image, record_size(record->len));
+            break;
+        case Job_Record:
+            // A compacted page only takes over once its header is in
+            if (!page_valid(job.page)) {
+                job.state = Job_PageHeader;
+                job.addr = job.page;
+                program_from((const uint8_t*)&job.header, PAGE_HEADER_SIZE);
+                break;
+            }
+            finish_job(HAL_OK);
+            break;
+        case Job_PageHeader:
+            finish_job(HAL_OK);
+            break;
+        default:
+            break;
+    }
+}
+
 /* 
- * Erase the configuration flash page.
+ * Erase a configuration flash page.
  * Returns HAL_OK if successful, or an error status otherwise.
  */
-HAL_StatusTypeDef epemul_erase_config_page(void)
+HAL_StatusTypeDef epemul_erase_page(uint32_t page_addr)
 {
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase = FLASH_TYPEERASE_PAGES,
+        .PageAddress = page_addr,
+        .NbPages = 1
+    };
+
     HAL_FLASH_Unlock();
     uint32_t PageError = 0;
     HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &PageError);
@@ -48,99 +408,133 @@ HAL_StatusTypeDef epemul_write_doubleword(uint32_t address, uint64_t data)
     return status;
 }
 
-/*
- * Write configuration data to a specified slot (index) within the reserved flash page.
- * 'size' must be a multiple of 8.
- *
- * The function reads the entire page into a temporary buffer and compares the current
- * data in the selected slot with the new data. If they differ, the slot in the buffer
- * is updated, the entire page is erased, and then the whole page is reprogrammed.
- *
- * Returns HAL_OK if all operations are successful.
- */
-HAL_StatusTypeDef epemul_write_config_data(uint8_t *data, uint32_t index, uint32_t size)
+void epemul_init(void)
 {
-    // Check that size is a multiple of 8
-    if (size % 8 != 0) {
+    HAL_NVIC_SetPriority(FLASH_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+HAL_StatusTypeDef epemul_queue_record(uint8_t key, const uint8_t *data, uint16_t len, EpemulWriteDone done)
+{
+    if (key > CONFIG_KEY_MAX || len == 0 || len > EPEMUL_QUEUE_RECORD_MAX) {
         return HAL_ERROR;
     }
 
-    // Calculate the slot's offset within the page
-    uint32_t offset = index * size;
-    if (offset + size > CONFIG_PAGE_SIZE) {
-        return HAL_ERROR; // Slot out of range
+    if (queue_count == EPEMUL_QUEUE_LENGTH) {
+        epemul_queue_full++;
+        return HAL_BUSY;
     }
 
-    uint8_t page_buffer[CONFIG_PAGE_SIZE];
-    // Read the entire current page from flash
-    memcpy(page_buffer, (uint8_t*)CONFIG_START_ADDR, CONFIG_PAGE_SIZE);
+    QueuedRecord *record = &queue[(queue_head + queue_count) % EPEMUL_QUEUE_LENGTH];
+    build_image(record, key, data, len);
+    record->done = done;
+    queue_count++;
+
+    events_post(EVENT_FLASH);
+    return HAL_OK;
+}
+
+uint8_t epemul_busy(void)
+{
+    return queue_count != 0;
+}
 
-    // If the slot already contains the new data, no update is necessary.
-    if (memcmp(&page_buffer[offset], data, size) == 0) {
-        return HAL_OK;
+void epemul_task(void)
+{
+    if (job.state == Job_Idle) {
+        if (queue_count == 0) return;
+        start_job();
     }
 
-    // Update the slot in the buffer with the new data.
-    memcpy(&page_buffer[offset], data, size);
+    if (job.state == Job_Erase) {
+        if (erase_pending) return;
 
-    // Erase the entire configuration page.
-    HAL_StatusTypeDef status = epemul_erase_config_page();
-    if (status != HAL_OK) {
-        return status;
+        HAL_FLASH_Lock();
+        if (erase_failed) {
+            finish_job(HAL_ERROR);
+            return;
+        }
+
+        job.state = Job_Copy;
+        if (!next_copy()) {
+            advance_job();
+        }
     }
 
-    // Write the whole page buffer back to flash, 8 bytes at a time.
-    uint32_t addr = CONFIG_START_ADDR;
-    for (uint32_t i = 0; i < CONFIG_PAGE_SIZE; i += 8)
-    {
-        uint64_t d = ((uint64_t)page_buffer[i])       |
-                     ((uint64_t)page_buffer[i+1] << 8)  |
-                     ((uint64_t)page_buffer[i+2] << 16) |
-                     ((uint64_t)page_buffer[i+3] << 24) |
-                     ((uint64_t)page_buffer[i+4] << 32) |
-                     ((uint64_t)page_buffer[i+5] << 40) |
-                     ((uint64_t)page_buffer[i+6] << 48) |
-                     ((uint64_t)page_buffer[i+7] << 56);
-        status = epemul_write_doubleword(addr, d);
-        if (status != HAL_OK) {
-            return status;
+    for (uint8_t i = 0; i < DOUBLEWORDS_PER_STEP && job.state != Job_Idle; i++) {
+        if (job.remaining == 0) {
+            advance_job();
+            continue;
+        }
+
+        uint64_t doubleword;
+        memcpy(&doubleword, job.src, sizeof(doubleword));
+
+        if (epemul_write_doubleword(job.addr, doubleword) != HAL_OK) {
+            // A record cut short fails its CRC, and a page without its
+            // header is never used, so the log is still consistent
+            finish_job(HAL_ERROR);
+            break;
         }
-        addr += 8;
+
+        job.addr += 8;
+        job.src += 8;
+        job.remaining -= 8;
+    }
+
+    // Come back for the rest, or the next record, straight away. An erase
+    // posts the event itself when it's done.
+    if (queue_count != 0 && !(job.state == Job_Erase && erase_pending)) {
+        events_post(EVENT_FLASH);
     }
-    return HAL_OK;
 }
 
-/*
- * Read configuration data from a specified slot (index) within the reserved flash page.
- * 'size' bytes are read from offset = index * size.
- *
- * Note: This function uses memcpy since the flash is memory-mapped.
- */
-void epemul_read_config_data(uint8_t *data, uint32_t index, uint32_t size)
+/* Invoked by HAL_FLASH_IRQHandler once the page erase has finished */
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
 {
-    uint32_t offset = index * size;
-    if (offset + size > CONFIG_PAGE_SIZE) {
-        // Out of range � handle error as needed.
-        return;
-    }
+    erase_pending = 0;
+    events_post(EVENT_FLASH);
+}
 
-    memcpy(data, (uint8_t*)(CONFIG_START_ADDR + offset), size);
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+    erase_failed = 1;
+    erase_pending = 0;
+    events_post(EVENT_FLASH);
 }
 
-/*
- * Search for the next free (erased) double word (8 bytes) address within the config flash area.
- * Returns the address if free space is found, or 0 if no free space is available.
- */
-uint32_t epemul_search_valid_addr(void)
-{
-    uint32_t addr;
-    for (addr = CONFIG_START_ADDR; addr <= CONFIG_END_ADDR - 8; addr += 8)
-    {
-        // Check both 32-bit words of the double word
-        if ((*(__IO uint32_t*)addr == 0xFFFFFFFF) && (*(__IO uint32_t*)(addr + 4) == 0xFFFFFFFF))
-        {
-            return addr;
+uint16_t epemul_read_record(uint8_t key, uint8_t *data, uint16_t size)
+{
+    // Queued records are newer than anything in flash
+    for (uint8_t i = queue_count; i > 0; i--) {
+        const QueuedRecord *record = &queue[(queue_head + i - 1) % EPEMUL_QUEUE_LENGTH];
+        if (record->key == key) {
+            memcpy(data, record->image + RECORD_HEADER_SIZE, record->len < size ? record->len : size);
+            return record->len;
         }
     }
-    return 0; // No free space found
+
+    uint32_t page = active_page();
+    if (page == 0) {
+        return 0;
+    }
+
+    uint32_t found = find_record(page, key);
+    if (found == 0) {
+        return 0;
+    }
+
+    uint16_t len = ((const RecordHeader*)found)->len;
+    memcpy(data, (const uint8_t*)(found + RECORD_HEADER_SIZE), len < size ? len : size);
+    return len;
+}
+
+uint8_t epemul_read_legacy(uint8_t *data, uint32_t size)
+{
+    if (page_valid(CONFIG_LEGACY_ADDR) || size > CONFIG_PAGE_SIZE) {
+        return 0;
+    }
+
+    memcpy(data, (uint8_t*)CONFIG_LEGACY_ADDR, size);
+    return 1;
 }
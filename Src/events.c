@@ -0,0 +1,103 @@
+#include "events.h"
+#include "timebase.h"
+#include "tusb.h"
+
+#ifdef USE_CMSIS_RTOS
+
+#define EVENTS_MAX_ROUTES (4U)
+
+typedef struct {
+    uint32_t events;
+    osMessageQId queue;
+} EventRoute;
+
+static EventRoute routes[EVENTS_MAX_ROUTES];
+static uint8_t route_count = 0;
+
+// Events that found their task's queue full. The task is awake with work
+// queued already, and does the same work for any message, so nothing is lost.
+// Public, so that contents can be inspected during debugging
+uint32_t events_queue_full = 0;
+
+void events_route(uint32_t events, osMessageQId queue) {
+    if (route_count == EVENTS_MAX_ROUTES) return;
+
+    routes[route_count].events = events;
+    routes[route_count].queue = queue;
+    route_count++;
+}
+
+void events_post(uint32_t events) {
+    for (uint8_t i = 0; i < route_count; i++) {
+        uint32_t routed = routes[i].events & events;
+
+        if (routed != 0 && osMessagePut(routes[i].queue, routed, 0) != osOK) {
+            events_queue_full++;
+        }
+    }
+}
+
+#else
+
+static volatile uint32_t pending = 0;
+
+// Time (timebase_cycles) the first of the pending events was posted
+static volatile uint32_t pending_since;
+
+// Cycles from an event being posted to the main loop picking it up, how
+// often the main loop went to sleep and how often it woke to dispatch.
+// The cycle counter doesn't run while the core sleeps, but events are always
+// posted by code running after the wake, so this is dispatch latency only.
+// Public, so that contents can be inspected during debugging
+uint32_t events_latency_last = 0;
+uint32_t events_latency_max = 0;
+uint32_t events_sleeps = 0;
+uint32_t events_dispatches = 0;
+
+void events_post(uint32_t events) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (pending == 0) {
+        pending_since = timebase_cycles();
+    }
+
+    pending |= events;
+
+    __set_PRIMASK(primask);
+}
+
+uint32_t events_wait() {
+    // With interrupts masked no event can be posted between checking for
+    // one and going to sleep. WFI still wakes on a pending interrupt, which
+    // runs as soon as they are unmasked again.
+    __disable_irq();
+
+    while (pending == 0) {
+        events_sleeps++;
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+
+    uint32_t events = pending;
+    uint32_t latency = timebase_cycles() - pending_since;
+    pending = 0;
+
+    __enable_irq();
+
+    events_latency_last = latency;
+    if (latency > events_latency_max) {
+        events_latency_max = latency;
+    }
+    events_dispatches++;
+
+    return events;
+}
+
+#endif
+
+// Invoked by usbd, usually from the USB interrupt
+void tud_event_queued_cb(void) {
+    events_post(EVENT_USB);
+}
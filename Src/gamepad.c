@@ -0,0 +1,32 @@
+#include "gamepad.h"
+#include "press_detect.h"
+#include "tusb.h"
+#include "tusb_hid.h"
+
+#define GAMEPAD_REPORT_LEN (2U)
+
+static uint16_t last_sent_buttons = 0;
+
+// Counts reports sent, for inspection while debugging
+uint32_t gamepad_reports_sent = 0;
+
+void gamepad_task() {
+    uint16_t buttons = press_detect_buttons();
+
+    if (buttons == last_sent_buttons) return;
+    if (!tud_hid_n_ready(USB_HID_INSTANCE_GAMEPAD)) return;
+
+    uint8_t report[GAMEPAD_REPORT_LEN] = {
+        buttons & 0xFF,
+        buttons >> 8
+    };
+
+    if (tud_hid_n_report(
+            USB_HID_INSTANCE_GAMEPAD,
+            USB_SEND_REPORT_ID,
+            report,
+            GAMEPAD_REPORT_LEN)) {
+        last_sent_buttons = buttons;
+        gamepad_reports_sent++;
+    }
+}
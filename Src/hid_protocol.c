@@ -0,0 +1,215 @@
+#include "hid_protocol.h"
+#include "config_mode.h"
+#include "led_frame.h"
+#include "debug_leds.h"
+#include "tusb.h"
+#include "tusb_hid.h"
+#include "string.h"
+
+// Precomputed magic signature for the version query, the SHA-512 of
+// "REFLEXPROTOCOL", in the manner of the config mode ones
+static const uint8_t version_query_magic[HID_PACKET_SIZE] = {
+    0xfe, 0x5b, 0x3a, 0x9c, 0xa4, 0xe3, 0x2a, 0x06,
+    0x25, 0xc5, 0x39, 0x91, 0x20, 0x43, 0x69, 0x9d,
+    0x2e, 0x26, 0x5d, 0x39, 0xf1, 0x5e, 0xcb, 0xc4,
+    0x56, 0x1d, 0x2d, 0xd0, 0xb0, 0x26, 0x26, 0x70,
+    0xfd, 0xf4, 0xd9, 0x9c, 0xb9, 0x6c, 0xad, 0xcc,
+    0x0b, 0x79, 0x2b, 0xfb, 0x46, 0xef, 0x99, 0xba,
+    0x77, 0x6e, 0x06, 0x7a, 0xcb, 0x2d, 0x78, 0x32,
+    0xdd, 0x21, 0xc4, 0x8e, 0xbb, 0xb6, 0xa8, 0x4b
+};
+
+static uint8_t handle_version(const uint8_t * packet, uint8_t * reply);
+static uint8_t handle_legacy(const uint8_t * packet, uint8_t * reply);
+
+static HidPacketHandler handlers[HID_PACKET_TYPE_COUNT] = {
+    [HID_PACKET_VERSION & ~HID_PACKET_TYPED_FLAG] = handle_version,
+    [HID_PACKET_LEGACY & ~HID_PACKET_TYPED_FLAG] = handle_legacy,
+};
+
+static uint8_t version = HID_PROTOCOL_LEGACY;
+
+// Typed LED segments carry a 3 bit frame number, where led_frame works with
+// 4 bits. Every segment's frame is taken to be within 4 frames either way of
+// the one before it.
+static uint8_t frame_last = 0;
+static uint8_t frame_unwrapped = 0;
+
+// Reply the IN endpoint was too busy for, sent ahead of the next sensor
+// report. A newer reply replaces it.
+static uint8_t pending_reply[HID_PACKET_SIZE];
+static uint8_t reply_pending = 0;
+
+// Public, so that contents can be inspected during debugging
+uint32_t hid_packets_unhandled = 0;
+uint32_t hid_replies_retried = 0;
+uint32_t hid_replies_dropped = 0;
+
+static inline uint8_t is_version_query(const uint8_t * packet) {
+    return packet[0] == version_query_magic[0]
+        && memcmp(packet, version_query_magic, HID_PACKET_SIZE) == 0;
+}
+
+// Legacy LED segment header for a typed one
+static inline uint8_t unwrap_led_header(uint8_t header) {
+    uint8_t frame = header & 0x07;
+    int8_t delta = (int8_t)(((frame - frame_last) & 0x07) << 5) >> 5;
+
+    frame_last = frame;
+    frame_unwrapped = (frame_unwrapped + delta) & 0x0F;
+
+    return (((header >> 3) & 0x0F) << 4) | frame_unwrapped;
+}
+
+static void dispatch_type(HidPacketType type, const uint8_t * packet) {
+    HidPacketHandler handler = handlers[type & ~HID_PACKET_TYPED_FLAG];
+
+    if (handler == NULL) {
+        hid_packets_unhandled++;
+        return;
+    }
+
+    uint8_t reply[HID_PACKET_SIZE] = {0};
+    if (!handler(packet, reply)) return;
+
+    reply[0] = hid_protocol_header(type);
+
+    // Keep replies in order
+    if (hid_protocol_send_pending()
+        && tud_hid_report(USB_SEND_REPORT_ID, reply, HID_PACKET_SIZE)) {
+        return;
+    }
+
+    if (reply_pending) hid_replies_dropped++;
+    memcpy(pending_reply, reply, HID_PACKET_SIZE);
+    reply_pending = 1;
+}
+
+static uint8_t handle_version(const uint8_t * packet, uint8_t * reply) {
+    reply[1] = version;
+    reply[2] = HID_PROTOCOL_NEWEST;
+    return true;
+}
+
+static uint8_t handle_legacy(const uint8_t * packet, uint8_t * reply) {
+    version = HID_PROTOCOL_LEGACY;
+    return false;
+}
+
+static void dispatch_legacy(uint8_t * packet) {
+    if (!is_config_mode()) {
+        led_frame_process_segment(packet);
+        return;
+    }
+
+    DBG_LED2_TOGGLE(); // Rapid blink comm LEDs
+
+    switch (packet[0]) {
+        case PROFILE_PUSH_PACKET:
+            dispatch_type(HID_PACKET_PROFILE_PUSH, packet);
+            break;
+        case PROFILE_READ_PACKET:
+            dispatch_type(HID_PACKET_PROFILE_READ, packet);
+            break;
+        case PROFILE_SWITCH_PACKET:
+            dispatch_type(HID_PACKET_PROFILE_SWITCH, packet);
+            break;
+        default:
+            hid_packets_unhandled++;
+            break;
+    }
+}
+
+void hid_protocol_register(HidPacketType type, HidPacketHandler handler) {
+    handlers[type & ~HID_PACKET_TYPED_FLAG] = handler;
+}
+
+uint8_t hid_protocol_version() {
+    return version;
+}
+
+void hid_protocol_reset() {
+    version = HID_PROTOCOL_LEGACY;
+    reply_pending = 0;
+}
+
+uint8_t hid_protocol_send_pending() {
+    if (!reply_pending) return true;
+
+    if (!tud_hid_report(USB_SEND_REPORT_ID, pending_reply, HID_PACKET_SIZE)) {
+        return false;
+    }
+
+    reply_pending = 0;
+    hid_replies_retried++;
+    return true;
+}
+
+uint8_t hid_protocol_header(HidPacketType type) {
+    if (version != HID_PROTOCOL_LEGACY) return type;
+
+    switch (type) {
+        case HID_PACKET_PROFILE_PUSH: return PROFILE_PUSH_PACKET;
+        case HID_PACKET_PROFILE_READ: return PROFILE_READ_PACKET;
+        case HID_PACKET_PROFILE_SAVED: return PROFILE_SAVED_PACKET;
+        case HID_PACKET_PROFILE_SWITCH: return PROFILE_SWITCH_PACKET;
+        default: return type;
+    }
+}
+
+void hid_protocol_dispatch(uint8_t * packet) {
+    // Either the "enter" or "exit" magic packet was received.
+    config_modes_t mode = packet_filter_for_config_mode(packet);
+    if (mode != CONFIG_MODE_NORMAL) {
+        version = HID_PROTOCOL_LEGACY;
+        set_config_mode(mode);
+        return;
+    }
+
+    if (is_version_query(packet)) {
+        version = HID_PROTOCOL_NEWEST;
+        set_config_mode(CONFIG_MODE_EXIT);
+        dispatch_type(HID_PACKET_VERSION, packet);
+        return;
+    }
+
+    if (version == HID_PROTOCOL_LEGACY) {
+        dispatch_legacy(packet);
+        return;
+    }
+
+    if (packet[0] & HID_PACKET_TYPED_FLAG) {
+        dispatch_type((HidPacketType)packet[0], packet);
+        return;
+    }
+
+    packet[0] = unwrap_led_header(packet[0]);
+    led_frame_process_segment(packet);
+}
+
+uint8_t hid_protocol_dispatch_isr(uint8_t * packet) {
+    // Magic packets, config mode and typed packets stay with the main loop
+    if (packet_filter_for_config_mode(packet) != CONFIG_MODE_NORMAL
+        || is_version_query(packet)) {
+        return 0;
+    }
+
+    if (version == HID_PROTOCOL_LEGACY) {
+        return !is_config_mode() && led_frame_process_segment_isr(packet);
+    }
+
+    if (packet[0] & HID_PACKET_TYPED_FLAG) return 0;
+
+    uint8_t header = packet[0];
+    uint8_t last = frame_last;
+    uint8_t unwrapped = frame_unwrapped;
+
+    packet[0] = unwrap_led_header(header);
+    if (led_frame_process_segment_isr(packet)) return 1;
+
+    // The main loop will unwrap it again
+    packet[0] = header;
+    frame_last = last;
+    frame_unwrapped = unwrapped;
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "led_codec.h"
+#include "led_frame.h"
+#include "timebase.h"
+#include "string.h"
+
+// Cycles taken by the last and slowest decode of each format.
+// Public, so that contents can be inspected during debugging
+volatile uint32_t led_codec_cycles_last[LED_BULK_FORMAT_COUNT] = {0};
+volatile uint32_t led_codec_cycles_max[LED_BULK_FORMAT_COUNT] = {0};
+
+// Byte offset of a pixel within the frame
+static inline uint16_t pixel_offset(uint16_t pixel) {
+    return (pixel / LED_PIXELS_PER_SEGMENT) * BYTES_PER_SEGMENT
+        + LED_SEGMENT_DATA_OFFSET
+        + (pixel % LED_PIXELS_PER_SEGMENT) * LED_BYTES_PER_PIXEL;
+}
+
+// Moves a pixel pointer on by one, hopping over the next segment header when
+// the end of a segment is reached.
+static inline uint8_t * next_pixel(uint8_t * p, uint8_t * left_in_segment) {
+    p += LED_BYTES_PER_PIXEL;
+
+    if (--(*left_in_segment) == 0) {
+        p += LED_SEGMENT_DATA_OFFSET;
+        *left_in_segment = LED_PIXELS_PER_SEGMENT;
+    }
+
+    return p;
+}
+
+static uint8_t decode_raw(const uint8_t * payload, uint16_t len, uint8_t * frame) {
+    if (len != LED_ARRAY_SIZE) return 0;
+
+    memcpy(frame, payload, LED_ARRAY_SIZE);
+    return 1;
+}
+
+static uint8_t decode_rle(const uint8_t * payload, uint16_t len, uint8_t * frame) {
+    if (len == 0 || len % 4 != 0) return 0;
+
+    uint16_t pixels = 0;
+    for (uint16_t i = 0; i < len; i += 4) {
+        if (payload[i] == 0) return 0;
+        pixels += payload[i];
+    }
+
+    if (pixels != LED_PIXEL_COUNT) return 0;
+
+    uint8_t * p = frame + LED_SEGMENT_DATA_OFFSET;
+    uint8_t left = LED_PIXELS_PER_SEGMENT;
+
+    for (uint16_t i = 0; i < len; i += 4) {
+        uint8_t r = payload[i + 1];
+        uint8_t g = payload[i + 2];
+        uint8_t b = payload[i + 3];
+
+        for (uint8_t n = payload[i]; n > 0; n--) {
+            p[0] = r;
+            p[1] = g;
+            p[2] = b;
+            p = next_pixel(p, &left);
+        }
+    }
+
+    return 1;
+}
+
+static uint8_t decode_palette(const uint8_t * payload, uint16_t len, uint8_t * frame) {
+    if (len == 0) return 0;
+
+    uint8_t colors = payload[0];
+    if (colors == 0 || colors > LED_PALETTE_MAX_COLORS) return 0;
+
+    const uint8_t * palette = payload + 1;
+    const uint8_t * indices = palette + colors * LED_BYTES_PER_PIXEL;
+    if (len != 1 + colors * LED_BYTES_PER_PIXEL + LED_PIXEL_COUNT / 2) return 0;
+
+    for (uint16_t i = 0; i < LED_PIXEL_COUNT / 2; i++) {
+        if ((indices[i] & 0x0F) >= colors || (indices[i] >> 4) >= colors) return 0;
+    }
+
+    uint8_t * p = frame + LED_SEGMENT_DATA_OFFSET;
+    uint8_t left = LED_PIXELS_PER_SEGMENT;
+
+    for (uint16_t i = 0; i < LED_PIXEL_COUNT / 2; i++) {
+        const uint8_t * low = palette + (indices[i] & 0x0F) * LED_BYTES_PER_PIXEL;
+        const uint8_t * high = palette + (indices[i] >> 4) * LED_BYTES_PER_PIXEL;
+
+        p[0] = low[0];
+        p[1] = low[1];
+        p[2] = low[2];
+        p = next_pixel(p, &left);
+
+        p[0] = high[0];
+        p[1] = high[1];
+        p[2] = high[2];
+        p = next_pixel(p, &left);
+    }
+
+    return 1;
+}
+
+static uint8_t decode_delta(const uint8_t * payload, uint16_t len, uint8_t * frame) {
+    // Walk the runs once to make sure they stay inside the frame and payload
+    uint16_t pixel = 0;
+    uint16_t i = 0;
+    while (i < len) {
+        if (len - i < 2) return 0;
+
+        pixel += payload[i] + payload[i + 1];
+        i += 2 + payload[i + 1] * LED_BYTES_PER_PIXEL;
+
+        if (pixel > LED_PIXEL_COUNT || i > len) return 0;
+    }
+
+    pixel = 0;
+    i = 0;
+    while (i < len) {
+        pixel += payload[i];
+        uint8_t count = payload[i + 1];
+        i += 2;
+
+        if (count == 0) continue;
+
+        uint8_t * p = frame + pixel_offset(pixel);
+        uint8_t left = LED_PIXELS_PER_SEGMENT - pixel % LED_PIXELS_PER_SEGMENT;
+        pixel += count;
+
+        for (; count > 0; count--) {
+            p[0] ^= payload[i];
+            p[1] ^= payload[i + 1];
+            p[2] ^= payload[i + 2];
+            i += LED_BYTES_PER_PIXEL;
+            p = next_pixel(p, &left);
+        }
+    }
+
+    return 1;
+}
+
+uint8_t led_codec_decode(
+    uint8_t format, const uint8_t * payload, uint16_t len, uint8_t * frame) {
+
+    uint32_t start = timebase_cycles();
+    uint8_t ok;
+
+    switch (format) {
+        case LED_BULK_FORMAT_RAW:
+            ok = decode_raw(payload, len, frame);
+            break;
+        case LED_BULK_FORMAT_RLE:
+            ok = decode_rle(payload, len, frame);
+            break;
+        case LED_BULK_FORMAT_PALETTE:
+            ok = decode_palette(payload, len, frame);
+            break;
+        case LED_BULK_FORMAT_DELTA:
+            ok = decode_delta(payload, len, frame);
+            break;
+        default:
+            return 0;
+    }
+
+    uint32_t cycles = timebase_cycles() - start;
+    led_codec_cycles_last[format] = cycles;
+    if (cycles > led_codec_cycles_max[format]) {
+        led_codec_cycles_max[format] = cycles;
+    }
+
+    return ok;
+}
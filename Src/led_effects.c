@@ -0,0 +1,140 @@
+#include "led_effects.h"
+#include "led_frame.h"
+#include "press_detect.h"
+#include "profile_config.h"
+#include "color.h"
+#include "string.h"
+
+#define GLOW_FULL (255U)
+
+static LedEffectsMode mode = LedEffects_Off;
+static Color_RGB glow_color;
+
+// How much a released panel's glow drops every LED_EFFECTS_FRAME_MS
+static uint8_t fade_step = GLOW_FULL;
+
+// Glow of each panel (by ComportId), linear: GLOW_FULL while pressed, down
+// to 0 once faded out
+static uint8_t glow[PANELS_PER_PLATFORM];
+static uint32_t last_fade;
+
+// Public, so that contents can be inspected during debugging
+uint32_t led_effects_updates = 0;
+
+// Adds a colour to pixels with saturation, four channels at a time. Pixels
+// need not be word aligned, which the Cortex-M4 copes with for word loads.
+static void add_pixels(uint8_t * pixel, uint8_t count, Color_RGB rgb) {
+    // Four pixels make three words: rgbr gbrg brgb
+    uint8_t pattern_bytes[4 * LED_BYTES_PER_PIXEL];
+    uint32_t pattern[LED_BYTES_PER_PIXEL];
+
+    for (uint8_t i = 0; i < 4; i++) {
+        pattern_bytes[i * 3] = rgb.red;
+        pattern_bytes[i * 3 + 1] = rgb.green;
+        pattern_bytes[i * 3 + 2] = rgb.blue;
+    }
+    memcpy(pattern, pattern_bytes, sizeof(pattern));
+
+    for (; count >= 4; count -= 4) {
+        for (uint8_t i = 0; i < LED_BYTES_PER_PIXEL; i++) {
+            uint32_t word;
+            memcpy(&word, pixel, sizeof(word));
+            word = __UQADD8(word, pattern[i]);
+            memcpy(pixel, &word, sizeof(word));
+            pixel += sizeof(word);
+        }
+    }
+
+    for (; count > 0; count--) {
+        for (uint8_t i = 0; i < LED_BYTES_PER_PIXEL; i++) {
+            pixel[i] = __UQADD8(pixel[i], pattern_bytes[i]);
+        }
+        pixel += LED_BYTES_PER_PIXEL;
+    }
+}
+
+void led_effects_load_profile(const uint8_t * profile) {
+    mode = profile[PROFILE_LED_EFFECTS_MODE_OFFSET];
+    if (mode > LedEffects_Idle) {
+        mode = LedEffects_Off;
+    }
+
+    glow_color.red = profile[PROFILE_LED_EFFECTS_COLOR_OFFSET];
+    glow_color.green = profile[PROFILE_LED_EFFECTS_COLOR_OFFSET + 1];
+    glow_color.blue = profile[PROFILE_LED_EFFECTS_COLOR_OFFSET + 2];
+
+    // 0 switches off straight away
+    fade_step = profile[PROFILE_LED_EFFECTS_FADE_OFFSET];
+    if (fade_step == 0) {
+        fade_step = GLOW_FULL;
+    }
+
+    memset(glow, 0, sizeof(glow));
+    last_fade = HAL_GetTick();
+}
+
+uint8_t led_effects_active(uint8_t host_idle) {
+    switch (mode) {
+        case LedEffects_Blend:
+        case LedEffects_Override:
+            return true;
+        case LedEffects_Idle:
+            return host_idle;
+        default:
+            return false;
+    }
+}
+
+uint8_t led_effects_update() {
+    if (mode == LedEffects_Off) return false;
+
+    uint8_t pressed = press_detect_panels();
+    uint8_t changed = false;
+
+    // Presses light up straight away, fades wait for their frame time
+    for (uint8_t panel = 0; panel < PANELS_PER_PLATFORM; panel++) {
+        if ((pressed & (1 << panel)) && glow[panel] != GLOW_FULL) {
+            glow[panel] = GLOW_FULL;
+            changed = true;
+        }
+    }
+
+    uint32_t now = HAL_GetTick();
+
+    if (now - last_fade >= LED_EFFECTS_FRAME_MS) {
+        last_fade = now;
+
+        for (uint8_t panel = 0; panel < PANELS_PER_PLATFORM; panel++) {
+            if ((pressed & (1 << panel)) || glow[panel] == 0) continue;
+
+            glow[panel] = glow[panel] > fade_step ? glow[panel] - fade_step : 0;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        led_effects_updates++;
+    }
+
+    return changed;
+}
+
+void led_effects_apply(uint8_t * frame) {
+    for (uint8_t panel = 0; panel < PANELS_PER_PLATFORM; panel++) {
+        // Gamma makes the fade look even to the eye
+        Color_RGB rgb = color_scale(glow_color, color_gamma(glow[panel]));
+
+        for (uint8_t segment = 0; segment < SEGMENTS_PER_PANEL; segment++) {
+            uint8_t * pixel = frame
+                + panel * BYTES_PER_PANEL
+                + segment * BYTES_PER_SEGMENT
+                + LED_SEGMENT_DATA_OFFSET;
+
+            if (mode != LedEffects_Blend) {
+                memset(pixel, 0, LED_PIXELS_PER_SEGMENT * LED_BYTES_PER_PIXEL);
+            }
+
+            add_pixels(pixel, LED_PIXELS_PER_SEGMENT, rgb);
+        }
+    }
+}
@@ -0,0 +1,599 @@
+#include "led_frame.h"
+#include "led_codec.h"
+#include "led_effects.h"
+#include "led_post.h"
+#include "msgbus.h"
+#include "debug_leds.h"
+#include "profile_config.h"
+#include "timebase.h"
+#include "config.h"
+#include "events.h"
+#include "string.h"
+
+#define SOF_PER_SECOND (1000U)
+
+// Frames live in a small pool of buffers, each in one of these roles:
+//   front:    the last committed frame, which the panels are being sent
+//   ready:    the newest complete frame, waiting for its commit
+//   assembly: a frame still receiving HID segments, one slot per frame id
+// Roles change by swapping pointers, from main loop context or from the USB
+// interrupt fast path while the main loop is outside this module, so a frame
+// is never written while UART DMA may still be reading it. front is only
+// replaced once msgbus has finished sending from it.
+#define LED_FRAME_BUFFER_COUNT (4U)
+#define LED_ASSEMBLY_SLOTS (LED_FRAME_BUFFER_COUNT - 2)
+
+// A frame still missing segments after this long is dropped
+#define LED_ASSEMBLY_TIMEOUT_US (100000U)
+
+// HID frame ids are 4 bit. One within this many ids behind the last complete
+// frame is considered late rather than a new frame.
+#define LED_LATE_FRAME_WINDOW (8U)
+
+typedef struct {
+    // Buffer being assembled into, NULL when the slot is unused
+    uint8_t * buffer;
+
+    uint8_t frame;
+    uint16_t segments_received;
+
+    // Time (timebase_us) the first segment arrived
+    uint32_t started_at;
+} AssemblySlot;
+
+static uint8_t frame_buffers[LED_FRAME_BUFFER_COUNT][LED_ARRAY_SIZE];
+static uint8_t * front = NULL;
+static uint8_t * ready = NULL;
+static AssemblySlot slots[LED_ASSEMBLY_SLOTS];
+
+// While on-board effects are active (see led_effects.h), or frames are
+// post-processed (see led_post.h), the panels are sent the front frame with
+// those applied, from its own buffer. sent_from is whichever of the two the
+// panels were last sent.
+static uint8_t composed[LED_ARRAY_SIZE] __attribute__ ((aligned(4)));
+static uint8_t * sent_from = NULL;
+static volatile uint8_t effects_active = 0;
+static uint8_t refresh_due = 0;
+
+// When the last complete frame came in from the host, by HAL_GetTick
+static uint8_t have_host_frame = 0;
+static uint32_t last_host_frame_at;
+
+// Last complete HID frame, for telling late segments from new frames
+static uint8_t last_complete_frame;
+static uint8_t have_last_complete = 0;
+static uint32_t last_complete_at;
+
+// Commit rate in frames per second, 0 to commit as soon as a frame is
+// complete. The SOF interrupt adds the rate to the accumulator every
+// millisecond and flags a commit each time it passes a second's worth.
+static uint8_t commit_rate = 0;
+static uint16_t sof_accumulator = 0;
+static volatile uint8_t commit_due = 0;
+
+// What each panel was last sent, so unchanged segments need not go over the
+// UART again. Segment header bytes carry the frame number, which changes
+// every frame, so only the pixel data is compared. A bit per segment in
+// shadow_valid, laid out like segments_received, says the shadow can be
+// trusted. It is dropped for a panel that isn't connected or has had a
+// request dropped, by timeout or fault, since it may not have kept what it
+// was sent.
+static uint8_t led_shadow[LED_ARRAY_SIZE];
+static uint16_t shadow_valid = 0x0000;
+static uint32_t shadow_dropped[PANELS_PER_PLATFORM];
+
+// Nesting depth of main loop calls into this module. The USB interrupt fast
+// path only touches frame state while it is zero.
+static volatile uint8_t lock_depth = 0;
+
+// Header of the last LED packet received, for inspection while debugging
+volatile uint8_t last_usb_header;
+
+// Bulk frame counters, for inspection while debugging
+uint32_t led_bulk_frames_received = 0;
+uint32_t led_bulk_frames_rejected = 0;
+
+// Frames committed, complete frames replaced by a newer one before their
+// commit came up, frames dropped before all segments arrived, and segments
+// that arrived for a frame already superseded.
+// Public, so that contents can be inspected during debugging
+uint32_t led_frames_committed = 0;
+uint32_t led_frames_dropped = 0;
+uint32_t led_frames_partial = 0;
+uint32_t led_segments_late = 0;
+
+// Segments sent to or skipped for the panels, for inspection while debugging
+uint32_t led_segments_sent = 0;
+uint32_t led_segments_skipped = 0;
+uint32_t led_bytes_skipped = 0;
+
+// Segments handled in the USB interrupt, segments it left for the main loop
+// because msgbus or this module were busy, segments sent ahead of their
+// frame's commit because the port was idle, and segments lost because every
+// buffer was still being sent from.
+// Public, so that contents can be inspected during debugging
+uint32_t led_isr_segments = 0;
+uint32_t led_isr_fallbacks = 0;
+uint32_t led_segments_streamed = 0;
+uint32_t led_segments_no_buffer = 0;
+
+// Frames committed for the on-board effects alone, with no new host frame
+// Public, so that contents can be inspected during debugging
+uint32_t led_effects_frames = 0;
+
+// Frame number of the last bulk frame, which delta frames build upon. Only
+// valid while it is also the newest complete frame.
+static uint8_t bulk_base_frame;
+static uint8_t bulk_base_valid = 0;
+
+static inline void send_commit_LEDs() {
+    Request req = request_create(Command_Commit_LEDs);
+    req.comport_id = Comport_Left;
+    msgbus_send_request(req);
+    req.comport_id = Comport_Down;
+    msgbus_send_request(req);
+    req.comport_id = Comport_Up;
+    msgbus_send_request(req);
+    req.comport_id = Comport_Right;
+    msgbus_send_request(req);
+}
+
+static inline void send_process_led_segment(uint8_t panel, uint8_t * data_ptr) {
+    Request req = request_create(Command_Process_LED_Segment);
+    req.comport_id = (ComportId)panel;
+    req.send_data = data_ptr;
+    req.send_data_len = BYTES_PER_SEGMENT;
+    msgbus_send_request(req);
+}
+
+static inline uint16_t segment_bit(uint8_t panel, uint8_t segment) {
+    return 1 << (panel * PANELS_PER_PLATFORM + segment);
+}
+
+static inline void check_panel_dropped(uint8_t panel) {
+    uint32_t dropped = msgbus_dropped_count((ComportId)panel);
+
+    if (dropped != shadow_dropped[panel]) {
+        shadow_dropped[panel] = dropped;
+        shadow_valid &= ~(0x000F << (panel * PANELS_PER_PLATFORM));
+    }
+}
+
+// Sends a segment of a frame to its panel, unless the panel already has the
+// same pixel data. Returns whether it was sent.
+static uint8_t send_segment_if_changed(uint8_t * frame, uint8_t panel, uint8_t segment) {
+    uint16_t offset = panel * BYTES_PER_PANEL + segment * BYTES_PER_SEGMENT;
+    uint16_t bit = segment_bit(panel, segment);
+    uint8_t * data = frame + offset + LED_SEGMENT_DATA_OFFSET;
+    uint8_t * shadow = led_shadow + offset + LED_SEGMENT_DATA_OFFSET;
+    uint16_t len = BYTES_PER_SEGMENT - LED_SEGMENT_DATA_OFFSET;
+
+    check_panel_dropped(panel);
+
+    if ((shadow_valid & bit) && memcmp(data, shadow, len) == 0) {
+        led_segments_skipped++;
+        led_bytes_skipped += BYTES_PER_SEGMENT;
+        return false;
+    }
+
+    memcpy(shadow, data, len);
+
+    if (panel_connected((ComportId)panel)) {
+        shadow_valid |= bit;
+    } else {
+        shadow_valid &= ~bit;
+    }
+
+    led_segments_sent++;
+    send_process_led_segment(panel, frame + offset);
+    return true;
+}
+
+static inline uint8_t front_busy(void) {
+    return sent_from != NULL && msgbus_sending_from(sent_from, LED_ARRAY_SIZE);
+}
+
+static inline uint8_t segment_header(uint8_t panel, uint8_t segment, uint8_t frame) {
+    return (panel << 6) | (segment << 4) | (frame & 0x0F);
+}
+
+static inline uint8_t host_idle(void) {
+    return !have_host_frame
+        || HAL_GetTick() - last_host_frame_at > LED_EFFECTS_HOST_IDLE_MS;
+}
+
+// What the panels should show: the front frame, or the effects rendered
+// over it and post-processing applied. Before the host has sent anything
+// that is over black.
+static uint8_t * output_frame(void) {
+    uint8_t post = led_post_enabled();
+
+    if (front != NULL && !effects_active && !post) return front;
+
+    if (front != NULL) {
+        memcpy(composed, front, LED_ARRAY_SIZE);
+    } else {
+        memset(composed, 0, LED_ARRAY_SIZE);
+
+        for (uint8_t panel = 0; panel < PANELS_PER_PLATFORM; panel++) {
+            for (uint8_t segment = 0; segment < SEGMENTS_PER_PANEL; segment++) {
+                composed[panel * BYTES_PER_PANEL + segment * BYTES_PER_SEGMENT]
+                    = segment_header(panel, segment, 0);
+            }
+        }
+    }
+
+    if (effects_active) {
+        led_effects_apply(composed);
+    }
+
+    if (post) {
+        led_post_process(composed);
+    }
+
+    return composed;
+}
+
+// Sends a frame to the panels and has them display it
+static void send_frame(uint8_t * frame) {
+    sent_from = frame;
+
+    for (uint8_t panel = 0; panel < PANELS_PER_PLATFORM; panel++) {
+        for (uint8_t segment = 0; segment < SEGMENTS_PER_PANEL; segment++) {
+            send_segment_if_changed(frame, panel, segment);
+        }
+    }
+
+    DBG_LED3_ON();
+    send_commit_LEDs();
+}
+
+// Makes the ready frame the front one, sends it to the panels and has them
+// display it. The old front buffer goes back to the pool.
+static void commit_frame(void) {
+    front = ready;
+    ready = NULL;
+    refresh_due = 0;
+
+    send_frame(output_frame());
+
+    led_frames_committed++;
+}
+
+static inline void try_commit(void) {
+    if (ready == NULL) {
+        commit_due = 0;
+        return;
+    }
+
+    if (commit_rate != 0 && !commit_due) return;
+    if (front_busy()) return;
+
+    commit_due = 0;
+    commit_frame();
+}
+
+// Segments streamed from a dropped frame may still be going out, so a buffer
+// is only free once msgbus is done with it too
+static inline uint8_t buffer_in_use(uint8_t * buffer) {
+    if (buffer == front || buffer == ready) return true;
+
+    for (uint8_t i = 0; i < LED_ASSEMBLY_SLOTS; i++) {
+        if (slots[i].buffer == buffer) return true;
+    }
+
+    return msgbus_sending_from(buffer, LED_ARRAY_SIZE);
+}
+
+static inline void release_slot(AssemblySlot * slot) {
+    slot->buffer = NULL;
+    slot->segments_received = 0x0000;
+}
+
+static inline void drop_slot(AssemblySlot * slot) {
+    release_slot(slot);
+    led_frames_partial++;
+}
+
+static AssemblySlot * find_slot(uint8_t frame) {
+    for (uint8_t i = 0; i < LED_ASSEMBLY_SLOTS; i++) {
+        if (slots[i].buffer != NULL && slots[i].frame == frame) return &slots[i];
+    }
+
+    return NULL;
+}
+
+// Takes an unused slot for a new frame, dropping the oldest partial frame if
+// there is none. With front and ready accounted for there is a free buffer
+// left for it, unless segments streamed from a dropped frame are still going
+// out, in which case NULL is returned.
+static AssemblySlot * claim_slot(uint8_t frame) {
+    AssemblySlot * slot = NULL;
+    uint32_t now = timebase_us();
+
+    for (uint8_t i = 0; i < LED_ASSEMBLY_SLOTS; i++) {
+        if (slots[i].buffer == NULL) {
+            slot = &slots[i];
+            break;
+        }
+
+        if (slot == NULL
+            || now - slots[i].started_at > now - slot->started_at) {
+            slot = &slots[i];
+        }
+    }
+
+    if (slot->buffer != NULL) {
+        drop_slot(slot);
+    }
+
+    for (uint8_t i = 0; i < LED_FRAME_BUFFER_COUNT; i++) {
+        if (!buffer_in_use(frame_buffers[i])) {
+            slot->buffer = frame_buffers[i];
+            break;
+        }
+    }
+
+    if (slot->buffer == NULL) return NULL;
+
+    slot->frame = frame;
+    slot->segments_received = 0x0000;
+    slot->started_at = now;
+    return slot;
+}
+
+// Hands a fully assembled frame over for commit, replacing one still waiting
+// for its turn. The commit itself is up to the caller.
+static void complete_slot(AssemblySlot * slot) {
+    if (ready != NULL) {
+        led_frames_dropped++;
+    }
+
+    ready = slot->buffer;
+    release_slot(slot);
+
+    have_host_frame = 1;
+    last_host_frame_at = HAL_GetTick();
+}
+
+static void expire_partial_frames(void) {
+    uint32_t now = timebase_us();
+
+    for (uint8_t i = 0; i < LED_ASSEMBLY_SLOTS; i++) {
+        if (slots[i].buffer != NULL
+            && now - slots[i].started_at > LED_ASSEMBLY_TIMEOUT_US) {
+            drop_slot(&slots[i]);
+        }
+    }
+
+    // After a quiet spell any frame id counts as new again, in case the host
+    // restarted its numbering
+    if (have_last_complete && now - last_complete_at > LED_ASSEMBLY_TIMEOUT_US) {
+        have_last_complete = 0;
+    }
+}
+
+// Whether frame a comes before frame b, for 4 bit HID frame ids
+static inline uint8_t frame_before(uint8_t a, uint8_t b) {
+    uint8_t behind = (b - a) & 0x0F;
+    return behind > 0 && behind < LED_LATE_FRAME_WINDOW;
+}
+
+// Has the panels show the effects as they change, or the front frame again
+// after a new profile. A host frame waiting for its commit will do that
+// anyway, so that is left to do it.
+static void update_effects(void) {
+    uint8_t active = led_effects_active(host_idle());
+
+    if (led_effects_update() && active) {
+        refresh_due = 1;
+    }
+
+    // Starting or stopping changes what the panels show as well
+    if (active != effects_active) {
+        effects_active = active;
+        refresh_due = 1;
+    }
+
+    if (!refresh_due || ready != NULL || front_busy()) return;
+
+    refresh_due = 0;
+    send_frame(output_frame());
+
+    led_effects_frames++;
+}
+
+void led_frame_load_profile(const uint8_t * profile) {
+    lock_depth++;
+    commit_rate = profile[PROFILE_LED_COMMIT_RATE_OFFSET];
+    sof_accumulator = 0;
+    commit_due = 0;
+
+    // Effects and post-processing settings may have changed what the panels
+    // should be showing
+    refresh_due = 1;
+    lock_depth--;
+}
+
+void led_frame_on_sof() {
+    if (commit_rate == 0) return;
+
+    sof_accumulator += commit_rate;
+
+    if (sof_accumulator >= SOF_PER_SECOND) {
+        sof_accumulator -= SOF_PER_SECOND;
+        commit_due = 1;
+    }
+}
+
+void led_frame_task() {
+    lock_depth++;
+    expire_partial_frames();
+    update_effects();
+    try_commit();
+    lock_depth--;
+}
+
+// Stores a segment into its frame. With stream set, the segment also goes to
+// its panel right away if the port has nothing else to do; the panel only
+// shows it on the next commit, and the shadow makes sure the commit sends
+// whatever the panel should have instead if this frame never makes it.
+// Segments aren't streamed while effects are active, as the commit would
+// send them again with the effects rendered in. A frame completed this way
+// is committed by led_frame_task.
+static void process_segment(uint8_t * packet, uint8_t stream) {
+    uint8_t header  = packet[0];
+    last_usb_header = header;
+    uint8_t panel   = (header >> 6) & 0x03;
+    uint8_t segment = (header >> 4) & 0x03;
+    uint8_t frame   = header & 0x0F;
+
+    if (have_last_complete && frame_before(frame, last_complete_frame)) {
+        led_segments_late++;
+        return;
+    }
+
+    AssemblySlot * slot = find_slot(frame);
+    if (slot == NULL) {
+        slot = claim_slot(frame);
+    }
+
+    if (slot == NULL) {
+        led_segments_no_buffer++;
+        return;
+    }
+
+    uint16_t buffer_offset = panel * BYTES_PER_PANEL + segment * BYTES_PER_SEGMENT;
+    memcpy(slot->buffer + buffer_offset, packet, BYTES_PER_SEGMENT);
+    slot->segments_received |= segment_bit(panel, segment);
+
+    if (stream && !effects_active && msgbus_port_ready((ComportId)panel)
+        && send_segment_if_changed(slot->buffer, panel, segment)) {
+        led_segments_streamed++;
+    }
+
+    if (slot->segments_received != COMPLETE_FRAME) return;
+
+    // Anything older still being assembled has been overtaken
+    for (uint8_t i = 0; i < LED_ASSEMBLY_SLOTS; i++) {
+        if (slots[i].buffer != NULL && frame_before(slots[i].frame, frame)) {
+            drop_slot(&slots[i]);
+        }
+    }
+
+    last_complete_frame = frame;
+    last_complete_at = timebase_us();
+    have_last_complete = 1;
+    bulk_base_valid = 0;
+
+    complete_slot(slot);
+
+    // Sending the frame is too much for the USB interrupt
+    if (stream) {
+        events_post(EVENT_LED);
+    } else {
+        try_commit();
+    }
+}
+
+void led_frame_process_segment(uint8_t * packet) {
+    lock_depth++;
+    process_segment(packet, false);
+    lock_depth--;
+}
+
+uint8_t led_frame_process_segment_isr(uint8_t * packet) {
+    if (lock_depth > 0 || msgbus_in_use()) {
+        led_isr_fallbacks++;
+        return 0;
+    }
+
+    process_segment(packet, true);
+    led_isr_segments++;
+    return 1;
+}
+
+static uint8_t process_bulk(const uint8_t * data, uint16_t len) {
+    led_bulk_frames_received++;
+
+    if (len < LED_BULK_HEADER_SIZE) {
+        led_bulk_frames_rejected++;
+        return 0;
+    }
+
+    uint8_t format = data[0];
+    uint8_t frame = data[1];
+    uint16_t payload_len = data[2] | (data[3] << 8);
+    const uint8_t * payload = data + LED_BULK_HEADER_SIZE;
+
+    if (len < LED_BULK_HEADER_SIZE + payload_len) {
+        led_bulk_frames_rejected++;
+        return 0;
+    }
+
+    if (format == LED_BULK_FORMAT_DELTA
+        && (!bulk_base_valid || frame != (uint8_t)(bulk_base_frame + 1))) {
+        led_bulk_frames_rejected++;
+        return 0;
+    }
+
+    // Bulk frames arrive whole, so they only borrow a slot for decoding.
+    // Delta frames start from a copy of the frame they build upon, which is
+    // the newest complete one.
+    AssemblySlot * slot = claim_slot(frame);
+    if (slot == NULL) {
+        led_bulk_frames_rejected++;
+        return 0;
+    }
+
+    uint8_t * buffer = slot->buffer;
+
+    if (format == LED_BULK_FORMAT_DELTA) {
+        memcpy(buffer, ready != NULL ? ready : front, LED_ARRAY_SIZE);
+    }
+
+    if (!led_codec_decode(format, payload, payload_len, buffer)) {
+        release_slot(slot);
+        led_bulk_frames_rejected++;
+        bulk_base_valid = 0;
+        return 0;
+    }
+
+    bulk_base_frame = frame;
+    bulk_base_valid = 1;
+    last_usb_header = frame;
+
+    for (uint8_t panel = 0; panel < PANELS_PER_PLATFORM; panel++) {
+        for (uint8_t segment = 0; segment < SEGMENTS_PER_PANEL; segment++) {
+            uint8_t * segment_ptr = buffer
+                + panel * BYTES_PER_PANEL
+                + segment * BYTES_PER_SEGMENT;
+
+            segment_ptr[0] = segment_header(panel, segment, frame);
+        }
+    }
+
+    complete_slot(slot);
+    try_commit();
+
+    return 1;
+}
+
+uint8_t led_frame_process_bulk(const uint8_t * data, uint16_t len) {
+    lock_depth++;
+    uint8_t accepted = process_bulk(data, len);
+    lock_depth--;
+
+    return accepted;
+}
+
+void led_frame_discard_bulk() {
+    led_bulk_frames_received++;
+    led_bulk_frames_rejected++;
+    bulk_base_valid = 0;
+}
+
+uint8_t led_frame_bulk_base(uint8_t * frame) {
+    *frame = bulk_base_frame;
+    return bulk_base_valid;
+}
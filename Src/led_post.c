@@ -0,0 +1,113 @@
+#include "led_post.h"
+#include "led_frame.h"
+#include "profile_config.h"
+#include "color.h"
+#include "timebase.h"
+
+#define SEGMENT_COUNT (PANELS_PER_PLATFORM * SEGMENTS_PER_PANEL)
+#define FRAME_WORDS (LED_ARRAY_SIZE / sizeof(uint32_t))
+
+// Brightness and gamma in one, rebuilt when a profile is loaded. Maps 0 to
+// 0 whatever the settings, which keeps segment headers out of the sums below.
+static uint8_t lut[256];
+static uint8_t lut_identity = 1;
+
+// Power budget as a sum of channel values, 0 for none
+static uint32_t budget = 0;
+
+// Cycles the last frame took and the most any has, estimated draw of the
+// last frame in mA before it was limited, and frames scaled down to fit the
+// budget.
+// Public, so that contents can be inspected during debugging
+uint32_t led_post_cycles = 0;
+uint32_t led_post_cycles_max = 0;
+uint32_t led_post_current_ma = 0;
+uint32_t led_post_frames_limited = 0;
+
+static inline uint32_t lut_word(uint32_t word) {
+    return lut[word & 0xFF]
+        | (lut[(word >> 8) & 0xFF] << 8)
+        | (lut[(word >> 16) & 0xFF] << 16)
+        | (lut[word >> 24] << 24);
+}
+
+// Scales the four bytes of a word by scale / 256, two at a time: once
+// unpacked to halfwords a byte times at most 256 can't carry into the next
+static inline uint32_t scale_word(uint32_t word, uint32_t scale) {
+    uint32_t even = ((__UXTB16(word) * scale) >> 8) & 0x00FF00FF;
+    uint32_t odd = (__UXTB16(__ROR(word, 8)) * scale) & 0xFF00FF00;
+
+    return even | odd;
+}
+
+void led_post_load_profile(const uint8_t * profile) {
+    // 0 is full brightness, which older profiles have in this byte
+    uint8_t brightness = profile[PROFILE_LED_BRIGHTNESS_OFFSET];
+    uint8_t gamma = profile[PROFILE_LED_GAMMA_OFFSET];
+    uint16_t factor = brightness == 0 ? 256 : brightness + 1;
+
+    lut_identity = 1;
+
+    for (uint16_t i = 0; i < 256; i++) {
+        uint8_t value = gamma ? color_gamma(i) : i;
+        lut[i] = (value * factor) >> 8;
+
+        if (lut[i] != i) {
+            lut_identity = 0;
+        }
+    }
+
+    budget = (uint32_t)profile[PROFILE_LED_POWER_BUDGET_OFFSET]
+        * LED_POST_BUDGET_STEP_MA * 255U / LED_POST_CHANNEL_MA;
+}
+
+uint8_t led_post_enabled() {
+    return !lut_identity || budget != 0;
+}
+
+void led_post_process(uint8_t * frame) {
+    uint32_t start = timebase_cycles();
+    uint32_t * words = (uint32_t *)frame;
+    uint8_t headers[SEGMENT_COUNT];
+    uint32_t sum = 0;
+
+    // Headers are zeroed while the pixels are worked on, so they pass
+    // through the table and sums as black
+    for (uint8_t i = 0; i < SEGMENT_COUNT; i++) {
+        headers[i] = frame[i * BYTES_PER_SEGMENT];
+        frame[i * BYTES_PER_SEGMENT] = 0;
+    }
+
+    if (lut_identity) {
+        for (uint16_t i = 0; i < FRAME_WORDS; i++) {
+            sum = __USADA8(words[i], 0, sum);
+        }
+    } else {
+        for (uint16_t i = 0; i < FRAME_WORDS; i++) {
+            uint32_t word = lut_word(words[i]);
+            words[i] = word;
+            sum = __USADA8(word, 0, sum);
+        }
+    }
+
+    led_post_current_ma = sum * LED_POST_CHANNEL_MA / 255U;
+
+    if (budget != 0 && sum > budget) {
+        uint32_t scale = (budget << 8) / sum;
+
+        for (uint16_t i = 0; i < FRAME_WORDS; i++) {
+            words[i] = scale_word(words[i], scale);
+        }
+
+        led_post_frames_limited++;
+    }
+
+    for (uint8_t i = 0; i < SEGMENT_COUNT; i++) {
+        frame[i * BYTES_PER_SEGMENT] = headers[i];
+    }
+
+    led_post_cycles = timebase_cycles() - start;
+    if (led_post_cycles > led_post_cycles_max) {
+        led_post_cycles_max = led_post_cycles;
+    }
+}
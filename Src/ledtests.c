@@ -3,9 +3,24 @@
 #include "request.h"
 #include "msgbus.h"
 #include "color.h"
+#include "timebase.h"
+
+#define COLOR_BENCHMARK_PIXELS (1024U)
+#define COLOR_BENCHMARK_CHUNK_PIXELS (16U)
 
 static uint8_t input_data[64];
 
+// Public, so that contents can be inspected during debugging
+uint32_t color_benchmark_reference_pps = 0;
+uint32_t color_benchmark_fixed_pps = 0;
+uint32_t color_benchmark_hsl8_pps = 0;
+uint32_t color_benchmark_correct_pps = 0;
+
+static uint32_t pixels_per_second(uint32_t cycles) {
+    if (cycles == 0) return 0;
+    return (uint64_t)COLOR_BENCHMARK_PIXELS * SystemCoreClock / cycles;
+}
+
 void ledtests_hardcoded_LEDs(ComportId port) {
     Request req;
 
@@ -87,7 +102,7 @@ void ledtests_loop_color_wheel(ComportId port) {
             hsl.saturation = 100;
             hsl.lightness = 1;
 
-            Color_RGB rgb = color_hsl_to_rgb(hsl);
+            Color_RGB rgb = color_hsl_to_rgb_fixed(hsl);
 
             ledtests_segments_solid_color(
                 Comport_Right, seg, rgb.red, rgb.green, rgb.blue
@@ -101,4 +116,41 @@ void ledtests_loop_color_wheel(ComportId port) {
         
         base_hue = (base_hue + hue_step) % 360;
     }
-}
\ No newline at end of file
+}
+
+// Times the HSL conversions and pixel correction of color.h, leaving their
+// throughput in the color_benchmark_*_pps variables
+void ledtests_color_benchmark() {
+    volatile Color_RGB sink;
+    uint32_t start;
+
+    start = timebase_cycles();
+    for (uint16_t i = 0; i < COLOR_BENCHMARK_PIXELS; i++) {
+        Color_HSL hsl = { i % 361, i % 101, (i >> 3) % 101 };
+        sink = color_hsl_to_rgb(hsl);
+    }
+    color_benchmark_reference_pps = pixels_per_second(timebase_cycles() - start);
+
+    start = timebase_cycles();
+    for (uint16_t i = 0; i < COLOR_BENCHMARK_PIXELS; i++) {
+        Color_HSL hsl = { i % 361, i % 101, (i >> 3) % 101 };
+        sink = color_hsl_to_rgb_fixed(hsl);
+    }
+    color_benchmark_fixed_pps = pixels_per_second(timebase_cycles() - start);
+
+    start = timebase_cycles();
+    for (uint16_t i = 0; i < COLOR_BENCHMARK_PIXELS; i++) {
+        Color_HSL8 hsl = { i * 64U, i, i >> 2 };
+        sink = color_hsl8_to_rgb(hsl);
+    }
+    color_benchmark_hsl8_pps = pixels_per_second(timebase_cycles() - start);
+
+    (void)sink;
+
+    // Corrected in place, a chunk at a time, so no frame sized buffer is needed
+    start = timebase_cycles();
+    for (uint16_t i = 0; i < COLOR_BENCHMARK_PIXELS / COLOR_BENCHMARK_CHUNK_PIXELS; i++) {
+        color_correct_pixels(input_data, COLOR_BENCHMARK_CHUNK_PIXELS, 128);
+    }
+    color_benchmark_correct_pps = pixels_per_second(timebase_cycles() - start);
+}
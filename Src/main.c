@@ -13,228 +13,574 @@
 #include "tusb_hid.h"
 #include "config_mode.h"
 #include "profile_config.h"
-
-#define USB_HID_PACKET_SIZE_BYTES (64U)
-#define BYTES_PER_SEGMENT (64U)
-#define SEGMENTS_PER_PANEL (4U)
-#define BYTES_PER_PANEL (BYTES_PER_SEGMENT * SEGMENTS_PER_PANEL)
-#define PANELS_PER_PLATFORM (4U)
-#define LED_ARRAY_SIZE (BYTES_PER_PANEL * PANELS_PER_PLATFORM)
-
-#define SENSOR_RESPONSE_LEN (8U)
-
-#define COMPLETE_FRAME (0xFFFF)
+#include "timebase.h"
+#include "sensor_report.h"
+#include "press_detect.h"
+#include "gamepad.h"
+#include "sensor_filter.h"
+#include "led_frame.h"
+#include "led_effects.h"
+#include "led_post.h"
+#include "events.h"
+#include "sensor_poll.h"
+#include "hid_protocol.h"
+#include "panel_detect.h"
+#include "string.h"
+
+#ifdef USE_CMSIS_RTOS
+#include "cmsis_os.h"
+
+// Sizes are in the unit the CMSIS-RTOS implementation expects
+#define RTOS_TASK_STACK_SIZE (512U)
+#define RTOS_QUEUE_LENGTH (8U)
+
+static osMessageQId bus_queue;
+static osMessageQId usb_queue;
+static osMessageQId lighting_queue;
+
+// Held while using msgbus, led_frame and the sensor modules, which were
+// written for a single thread
+static osMutexId state_mutex;
+
+// Held while using eeprom_emul and the save acknowledgements
+static osMutexId flash_mutex;
+#endif
 
 volatile ErrorCode Panic_Error = 0;
 volatile uint32_t Panic_Data = 0;
 
-uint8_t sensor_buffer[USB_HID_PACKET_SIZE_BYTES];
-uint8_t usb_sensor_buffer[USB_HID_PACKET_SIZE_BYTES];
-
-volatile uint8_t last_usb_header;
 volatile uint32_t packets_fetched = 0;
 
+// Profile saves that have finished but not been acknowledged to the host
+// yet, and the outcome of the last one
+static uint8_t save_acks_pending = 0;
+static HAL_StatusTypeDef save_ack_status = HAL_OK;
+
 static void init_system_clock(void);
 static void init_gpio(void);
 
 static void init();
+#ifdef USE_CMSIS_RTOS
+static void run_rtos();
+#else
 static void run();
+#endif
 static void test();
-static void process_hid_packet(void);
-static inline void process_led_data(uint8_t *packet);
-
-static inline void send_request_sensors() {
-    Request req = request_create(Command_Request_Sensors);
-    req.response_len = SENSOR_RESPONSE_LEN;
+static void process_hid_packets(void);
+static void process_bulk_frame(void);
+
+// Polls a panel for full readings, or for just its press mask when the
+// profile has full readings fetched less often
+static inline void send_request_sensor(ComportId port) {
+    Request req;
+
+    if (sensor_poll_next_is_full(port)) {
+        req = request_create(Command_Request_Sensors);
+        req.response_len = SENSOR_RESPONSE_LEN;
+        req.response_data = sensor_report_poll_buffer(port);
+    } else {
+        req = request_create(Command_Request_Press_Mask);
+        req.response_len = PRESS_MASK_RESPONSE_LEN;
+        req.response_data = press_detect_mask_buffer(port);
+    }
 
-    req.comport_id = Comport_Left;
-    req.response_data = sensor_buffer + \
-        ((uint8_t)Comport_Left) * SENSOR_RESPONSE_LEN;
+    req.comport_id = port;
     msgbus_send_request(req);
+}
 
-    req.comport_id = Comport_Down;
-    req.response_data = sensor_buffer + \
-        ((uint8_t)Comport_Down) * SENSOR_RESPONSE_LEN;
-    msgbus_send_request(req);
+// Gives a panel the profile's thresholds, for answering press mask polls.
+// Left out while the profile only has full polls sent, so panels that don't
+// know the command aren't taken for gone.
+static void send_thresholds_to(ComportId port) {
+    if (!sensor_poll_uses_press_masks()) {
+        return;
+    }
 
-    req.comport_id = Comport_Up;
-    req.response_data = sensor_buffer + \
-        ((uint8_t)Comport_Up) * SENSOR_RESPONSE_LEN;
+    Request req = request_create(Command_Set_Thresholds);
+    req.comport_id = port;
+    req.send_data = (uint8_t *)press_detect_panel_thresholds(port);
+    req.send_data_len = PRESS_PANEL_THRESHOLDS_LEN;
     msgbus_send_request(req);
+}
 
-    req.comport_id = Comport_Right;
-    req.response_data = sensor_buffer + \
-        ((uint8_t)Comport_Right) * SENSOR_RESPONSE_LEN;
-    msgbus_send_request(req);
+static void send_thresholds(void) {
+    for (uint8_t port = 0; port <= COMPORT_ID_MAX; port++) {
+        send_thresholds_to((ComportId)port);
+    }
 }
 
-static inline void send_sensor_update_usb() {
-    tud_hid_report(
-        USB_SEND_REPORT_ID,
-        usb_sensor_buffer,
-        USB_HID_PACKET_SIZE_BYTES
-    );
+// Follows which panels are answering, and gives ones that have just turned
+// up the thresholds they missed
+static void detect_panels(void) {
+    panel_detect_task();
+
+    uint8_t found = panel_detect_take_found();
+    uint8_t lost = panel_detect_take_lost();
+
+    for (uint8_t port = 0; port <= COMPORT_ID_MAX; port++) {
+        if (found & (1 << port)) {
+            send_thresholds_to((ComportId)port);
+        }
+
+        // Otherwise its buttons would stay held and its glow lit
+        if (lost & (1 << port)) {
+            press_detect_clear_panel((ComportId)port);
+            sensor_report_clear_panel((ComportId)port);
+        }
+    }
+}
+
+static inline void send_request_sensors() {
+    send_request_sensor(Comport_Left);
+    send_request_sensor(Comport_Down);
+    send_request_sensor(Comport_Up);
+    send_request_sensor(Comport_Right);
+}
+
+// Polls the panels for sensor data, on every tick of the poll timer if the
+// profile sets a poll rate, otherwise whenever the bus has moved on
+static void poll_sensors(uint32_t events) {
+    if (sensor_poll_free_running()) {
+        if (events & (EVENT_BUS | EVENT_TICK)) {
+            send_request_sensors();
+        }
+        return;
+    }
+
+    if (!(events & EVENT_POLL)) return;
+
+    sensor_poll_begin();
+
+    for (uint8_t port = 0; port <= COMPORT_ID_MAX; port++) {
+        if (sensor_poll_start((ComportId)port)) {
+            send_request_sensor((ComportId)port);
+        }
+    }
+}
+
+// Reports go as soon as there's anything new for the host, or with a lead
+// time set, when their slot before the IN token comes up
+static inline void send_sensor_update_usb(uint32_t events) {
+    uint32_t due = sensor_report_aligned()
+        ? EVENT_REPORT
+        : (EVENT_BUS | EVENT_USB);
+
+    if (events & due) {
+        sensor_report_send();
+    }
 }
 
 // Breaks when this is being done after a bunch of times
 static inline void process_sensor_data(Response * resp) {
-    uint8_t offset = (uint8_t)resp->comport_id * SENSOR_RESPONSE_LEN;
+    sensor_poll_answered(resp->comport_id, true);
+    sensor_filter_apply(resp->comport_id, resp->data);
+    sensor_report_store(resp);
+    press_detect_update(resp->comport_id, resp->data);
+}
 
-    // Copy data over into usb sensor array
-    for (uint8_t i = 0; i < resp->data_length; i++) {
-        usb_sensor_buffer[offset + i] = resp->data[i];
-    }   
+static inline void process_press_mask(Response * resp) {
+    sensor_poll_answered(resp->comport_id, false);
+    sensor_report_store_mask(resp);
+    press_detect_update_mask(resp->comport_id, resp->data[0]);
 }
 
-static inline void send_commit_LEDs() {
-    Request req = request_create(Command_Commit_LEDs);
-    req.comport_id = Comport_Left;
-    msgbus_send_request(req);
-    req.comport_id = Comport_Down;
-    msgbus_send_request(req);
-    req.comport_id = Comport_Up;
-    msgbus_send_request(req);
-    req.comport_id = Comport_Right;
-    msgbus_send_request(req);
+// Hands profile settings to the modules that work from them
+static void apply_profile(const uint8_t * profile) {
+    sensor_filter_load_profile(profile);
+    press_detect_load_profile(profile);
+    led_frame_load_profile(profile);
+    led_effects_load_profile(profile);
+    led_post_load_profile(profile);
+    sensor_poll_load_profile(profile);
+    sensor_report_load_profile(profile);
+    send_thresholds();
 }
 
-static inline void send_process_led_segment(uint8_t panel, uint8_t * data_ptr) {
-    Request req = request_create(Command_Process_LED_Segment);
-    req.comport_id = (ComportId)panel;
-    req.send_data = data_ptr;
-    req.send_data_len = BYTES_PER_SEGMENT;
-    msgbus_send_request(req);
+// Handles responses from the panels. Returns whether any sensor data came in.
+static uint8_t process_responses(void) {
+    uint8_t sensor_data = false;
+
+    while (msgbus_have_pending_response()) {
+        Response *resp = msgbus_get_pending_response();
+        switch (resp->request_command) {
+            case Command_Request_Sensors:
+                process_sensor_data(resp);
+                sensor_data = true;
+                break;
+            case Command_Request_Press_Mask:
+                process_press_mask(resp);
+                sensor_data = true;
+                break;
+            // Add other command responses if needed.
+        }
+    }
+
+    return sensor_data;
 }
 
+// Invoked by epemul_task once a pushed profile is in flash
+static void profile_saved(uint8_t key, HAL_StatusTypeDef status) {
+    save_ack_status = status;
+    if (save_acks_pending < UINT8_MAX) {
+        save_acks_pending++;
+    }
 
-static void process_hid_packet(void) {
-    uint8_t *packet = usb_get_packet();
-    if (packet == NULL) {
-        return;
+    // Wakes whoever sends the acknowledgement
+    events_post(EVENT_FLASH);
+}
+
+// Lets the host know its profile is saved, once the HID endpoint is free
+static void send_save_acks(void) {
+#ifdef USE_CMSIS_RTOS
+    osMutexWait(flash_mutex, osWaitForever);
+#endif
+    while (save_acks_pending > 0) {
+        uint8_t reply[64] = {0};
+        reply[0] = hid_protocol_header(HID_PACKET_PROFILE_SAVED);
+        reply[1] = save_ack_status;
+
+        if (!tud_hid_report(USB_SEND_REPORT_ID, reply, 64)) break;
+        save_acks_pending--;
     }
-    
-    // First, use the config-mode filter to check for enter/exit packets.
-    config_modes_t mode = packet_filter_for_config_mode(packet);
-    if (mode != CONFIG_MODE_NORMAL) {
-        // Either the "enter" or "exit" magic packet was received.
-        set_config_mode(mode);
-        return;
+#ifdef USE_CMSIS_RTOS
+    osMutexRelease(flash_mutex);
+#endif
+}
+
+// Pushed profiles go to the active slot and take effect right away. Writing
+// it to flash is left to epemul_task, a few doublewords per pass, so the bus
+// and USB keep going. The host hears back once it's saved.
+static uint8_t handle_profile_push(const uint8_t * packet, uint8_t * reply) {
+    const uint8_t * profile = packet + 1;
+
+#ifdef USE_CMSIS_RTOS
+    osMutexWait(flash_mutex, osWaitForever);
+#endif
+    uint8_t slot = profile_config_active_slot();
+    HAL_StatusTypeDef status = profile_config_save(slot, profile, profile_saved);
+    if (status != HAL_OK) {
+        profile_saved(PROFILE_SLOT_KEY(slot), status);
     }
-    
-    // Process LED Data or Config Packets
-    if (!is_config_mode()) {
-        process_led_data(packet);
+#ifdef USE_CMSIS_RTOS
+    osMutexRelease(flash_mutex);
+#endif
+
+    apply_profile(profile_config_active());
+    return false;
+}
+
+static uint8_t handle_profile_read(const uint8_t * packet, uint8_t * reply) {
+    memcpy(reply + 1, profile_config_active(), PROFILE_DATA_LEN);
+    return true;
+}
+
+// Profiles are cached in RAM, so switching is just applying another one.
+// Replies with the active slot, which lets the host ask for it by sending
+// a slot that doesn't exist.
+static uint8_t handle_profile_switch(const uint8_t * packet, uint8_t * reply) {
+#ifdef USE_CMSIS_RTOS
+    osMutexWait(flash_mutex, osWaitForever);
+#endif
+    bool switched = profile_config_switch(packet[1]);
+    uint8_t active = profile_config_active_slot();
+#ifdef USE_CMSIS_RTOS
+    osMutexRelease(flash_mutex);
+#endif
+
+    if (switched) {
+        apply_profile(profile_config_active());
     }
-    else // is_config_mode
-    {
-        DBG_LED2_TOGGLE(); // Rapid blink comm LEDs
-        
-        uint8_t header = packet[0];
-        if (header == PROFILE_PUSH_PACKET) {
-            // Bytes 1�32 contain sensor thresholds/hysteresis data and bytes 33�36 the panel keys.
-            // Save this configuration using the profile_config module.
-            HAL_StatusTypeDef status = profile_config_save(packet + 1);
-        } else if (header == PROFILE_READ_PACKET) {
-            // Prepare a reply packet with header 0xF1 and profile data read from EEPROM.
-            uint8_t reply[64] = {0};
-            reply[0] = 0xF1;
-            profile_config_read(reply + 1);
-            tud_hid_report(USB_SEND_REPORT_ID, reply, 64);
-        }
+
+    reply[1] = active;
+    reply[2] = PROFILE_SLOT_COUNT;
+    return true;
+}
+
+// Telemetry snapshot, all values little endian:
+//  1..4   Device time in microseconds
+//  5..12  Sensor responses per second, per panel in ComportId order
+// 13..28  Message bus timeouts, per port
+// 29..30  Pressed sensors, as in the sensor report
+// 31      Active profile slot
+// 32      Whether profile writes to flash are still queued
+// 33..36  Bulk LED frames rejected
+// 37      Whether bulk delta frames are accepted
+// 38      Frame number the next bulk delta frame has to follow
+// 39..42  Cycles the last LED frame's post-processing took
+// 43..46  Estimated current draw of the last LED frame in mA, before the
+//         power budget was applied
+// 47..62  Message bus port resets after faults, per port
+static uint8_t handle_telemetry(const uint8_t * packet, uint8_t * reply) {
+    uint32_t now = timebase_us();
+    memcpy(reply + 1, &now, sizeof(now));
+
+    for (uint8_t port = 0; port <= COMPORT_ID_MAX; port++) {
+        uint32_t rate = sensor_poll_rate_achieved((ComportId)port);
+        uint16_t rate16 = rate > 0xFFFF ? 0xFFFF : rate;
+        uint32_t timeouts = msgbus_timeout_count((ComportId)port);
+        uint32_t faults = msgbus_fault_count((ComportId)port);
+
+        memcpy(reply + 5 + port * 2, &rate16, sizeof(rate16));
+        memcpy(reply + 13 + port * 4, &timeouts, sizeof(timeouts));
+        memcpy(reply + 47 + port * 4, &faults, sizeof(faults));
     }
+
+    uint16_t pressed = press_detect_sensors();
+    memcpy(reply + 29, &pressed, sizeof(pressed));
+    reply[31] = profile_config_active_slot();
+    reply[32] = epemul_busy();
+    memcpy(reply + 33, &led_bulk_frames_rejected, sizeof(led_bulk_frames_rejected));
+    reply[37] = led_frame_bulk_base(&reply[38]);
+    memcpy(reply + 39, &led_post_cycles, sizeof(led_post_cycles));
+    memcpy(reply + 43, &led_post_current_ma, sizeof(led_post_current_ma));
+    return true;
 }
 
-static inline void process_led_data(uint8_t *packet) {
-    static uint16_t segments_received = 0x0000;
-    static uint8_t led_buffer[LED_ARRAY_SIZE];
-    static uint8_t previous_frame = 0xFF;
-    
-    // If the previous full frame has been received, commit the LED data.
-    if (segments_received == COMPLETE_FRAME) {
-        DBG_LED3_ON();
-        segments_received = 0x0000;
-        send_commit_LEDs();
+// Works through every packet the host has sent since the last call
+static void process_hid_packets(void) {
+    uint8_t *packet;
+
+    while ((packet = usb_get_packet()) != NULL) {
+        hid_protocol_dispatch(packet);
+        usb_consume_packet();
     }
-    
-    uint8_t header  = packet[0];
-    last_usb_header = header;
-    uint8_t panel   = (header >> 6) & 0x03;
-    uint8_t segment = (header >> 4) & 0x03;
-    uint8_t frame   = header & 0x0F;
-    
-    uint16_t buffer_offset = panel * BYTES_PER_PANEL + segment * BYTES_PER_SEGMENT;
-    
-    for (uint8_t i = 0; i < USB_HID_PACKET_SIZE_BYTES; i++) {
-        led_buffer[i + buffer_offset] = packet[i];
+}
+
+// Whole LED frames can also arrive through the vendor bulk endpoint, which
+// holds off further transfers until the current one has been handed over.
+static void process_bulk_frame(void) {
+    uint16_t len = tud_vendor_available();
+    if (len == 0) {
+        return;
     }
 
-    if (frame != previous_frame) {
-        segments_received = 0x0000;
+    if (!is_config_mode()) {
+        led_frame_process_bulk(tud_vendor_buffer(), len);
+    } else {
+        led_frame_discard_bulk();
     }
 
-    previous_frame = frame;
-    segments_received |= (1 << (panel * PANELS_PER_PLATFORM + segment));
-    send_process_led_segment(panel, led_buffer + buffer_offset);
+    tud_vendor_read_done();
 }
 
 int main(void){
     init();
     //test();
+#ifdef USE_CMSIS_RTOS
+    run_rtos();
+#else
     run();
+#endif
 }
 
 static void init() {
     HAL_Init();
     init_gpio();
     init_system_clock();
+    timebase_init();
     uart_init();
     msgbus_init();
+    panel_detect_init();
+    epemul_init();
     tusb_init();
+
+    hid_protocol_register(HID_PACKET_PROFILE_PUSH, handle_profile_push);
+    hid_protocol_register(HID_PACKET_PROFILE_READ, handle_profile_read);
+    hid_protocol_register(HID_PACKET_PROFILE_SWITCH, handle_profile_switch);
+    hid_protocol_register(HID_PACKET_TELEMETRY, handle_telemetry);
+
+    profile_config_init();
+    apply_profile(profile_config_active());
     
     DBG_LED1_ON();
 }
 
+#ifndef USE_CMSIS_RTOS
 static void run(void) {
     send_request_sensors();
     
     while (1) {
-        // Process any pending messages from the internal (panel-to-panel) comms.
-        msgbus_process_flags();
-        
-        if (msgbus_have_pending_response()) {
-            Response *resp = msgbus_get_pending_response();
-            switch (resp->request_command) {
-                case Command_Request_Sensors:
-                    process_sensor_data(resp);
-                    break;
-                // Add other command responses if needed.
-            }
+        // Sleep until an interrupt flags work, then only do what it calls for.
+        uint32_t events = events_wait();
+
+        if (events & (EVENT_BUS | EVENT_TICK)) {
+            // Process any pending messages from the internal (panel-to-panel)
+            // comms. The tick drives the response timeouts.
+            msgbus_process_flags();
+            process_responses();
+        }
+
+        if (events & EVENT_TICK) {
+            // Drop panels that stopped answering, and probe for ones that
+            // went away or were never there.
+            detect_panels();
+        }
+
+        if (events & EVENT_USB) {
+            // Let the TinyUSB stack process USB events, which is where
+            // packets from the host get queued.
+            tud_task();
+
+            // Instead of directly processing LED data, process any incoming USB HID packets.
+            // This will filter out config packets and process profile commands if in config mode.
+            process_hid_packets();
+            process_bulk_frame();
         }
-        
-        // Instead of directly processing LED data, process any incoming USB HID packets.
-        // This will filter out config packets and process profile commands if in config mode.
-        process_hid_packet();
-        
-        // Only send sensor data over USB if we are in normal (non-config) mode.
-        if (!is_config_mode()) {
-            send_sensor_update_usb();
+
+        if (events & EVENT_TICK) {
+            // Save the active profile slot once it has settled.
+            profile_config_task();
         }
-        
+
+        if (events & EVENT_FLASH) {
+            // Move queued profile saves along, a little at a time.
+            epemul_task();
+        }
+
+        if (events & (EVENT_USB | EVENT_FLASH)) {
+            send_save_acks();
+        }
+
+        // Commit the newest complete LED frame if one is due. Commits are
+        // paced by SOF, wait on the bus, and partial frames expire by time.
+        // On-board effects send frames of their own as presses change.
+        led_frame_task();
+
+        // Replies the host is waiting on go out ahead of sensor data, which
+        // is only sent over USB if we are in normal (non-config) mode.
+        uint8_t replies_sent = hid_protocol_send_pending();
+        if (!is_config_mode() && replies_sent) {
+            send_sensor_update_usb(events);
+        }
+
+        if (events & (EVENT_BUS | EVENT_USB)) {
+            // Report on-board step detection through the gamepad interface.
+            gamepad_task();
+        }
+
         // Always keep requesting sensor data.
-        send_request_sensors();
-        
-        // Let the TinyUSB stack process USB events.
+        poll_sensors(events);
+    }
+}
+#endif
+
+#ifdef USE_CMSIS_RTOS
+// RTOS build: the work of run() split over tasks by priority, so a long
+// tud_task or a flash write can't hold up the panel bus.
+//   bus:      panel messages, sensor data and polling (highest)
+//   usb:      tud_task, packets from the host, sensor and gamepad reports
+//   lighting: LED frame commits, and writing profiles pushed by the host and
+//             the active slot to flash
+// Interrupts wake the tasks through their message queues (see events.c),
+// and the bus task tells the usb task about new sensor data the same way.
+
+static void bus_task(void const * argument) {
+    osMutexWait(state_mutex, osWaitForever);
+    send_request_sensors();
+    osMutexRelease(state_mutex);
+
+    while (1) {
+        osEvent event = osMessageGet(bus_queue, osWaitForever);
+
+        osMutexWait(state_mutex, osWaitForever);
+        msgbus_process_flags();
+        uint8_t sensor_data = process_responses();
+
+        if (event.value.v & EVENT_TICK) {
+            detect_panels();
+        }
+
+        poll_sensors(event.value.v);
+        osMutexRelease(state_mutex);
+
+        // New sensor data is a bus event as far as the usb task is concerned
+        if (sensor_data) {
+            osMessagePut(usb_queue, EVENT_BUS, 0);
+        }
+    }
+}
+
+static void usb_task(void const * argument) {
+    while (1) {
+        osEvent event = osMessageGet(usb_queue, osWaitForever);
+
         tud_task();
+
+        osMutexWait(state_mutex, osWaitForever);
+        process_hid_packets();
+        process_bulk_frame();
+
+        uint8_t replies_sent = hid_protocol_send_pending();
+        if (!is_config_mode() && replies_sent) {
+            send_sensor_update_usb(event.value.v);
+        }
+
+        gamepad_task();
+        osMutexRelease(state_mutex);
+
+        send_save_acks();
+    }
+}
+
+static void lighting_task(void const * argument) {
+    while (1) {
+        osEvent event = osMessageGet(lighting_queue, osWaitForever);
+
+        if (event.value.v & (EVENT_FLASH | EVENT_TICK)) {
+            osMutexWait(flash_mutex, osWaitForever);
+            profile_config_task();
+            epemul_task();
+            osMutexRelease(flash_mutex);
+        }
+
+        osMutexWait(state_mutex, osWaitForever);
+        led_frame_task();
+        osMutexRelease(state_mutex);
     }
 }
 
+osThreadDef(bus_task, osPriorityHigh, 1, RTOS_TASK_STACK_SIZE);
+osThreadDef(usb_task, osPriorityAboveNormal, 1, RTOS_TASK_STACK_SIZE);
+osThreadDef(lighting_task, osPriorityNormal, 1, RTOS_TASK_STACK_SIZE);
+osMessageQDef(bus_queue, RTOS_QUEUE_LENGTH, uint32_t);
+osMessageQDef(usb_queue, RTOS_QUEUE_LENGTH, uint32_t);
+osMessageQDef(lighting_queue, RTOS_QUEUE_LENGTH, uint32_t);
+osMutexDef(state_mutex);
+osMutexDef(flash_mutex);
+
+static void run_rtos(void) {
+    osKernelInitialize();
+
+    state_mutex = osMutexCreate(osMutex(state_mutex));
+    flash_mutex = osMutexCreate(osMutex(flash_mutex));
+    bus_queue = osMessageCreate(osMessageQ(bus_queue), NULL);
+    usb_queue = osMessageCreate(osMessageQ(usb_queue), NULL);
+    lighting_queue = osMessageCreate(osMessageQ(lighting_queue), NULL);
+
+    events_route(EVENT_BUS | EVENT_TICK | EVENT_POLL, bus_queue);
+    events_route(EVENT_USB | EVENT_REPORT | EVENT_FLASH, usb_queue);
+    events_route(EVENT_BUS | EVENT_SOF | EVENT_TICK | EVENT_LED | EVENT_FLASH, lighting_queue);
+
+    osThreadCreate(osThread(bus_task), NULL);
+    osThreadCreate(osThread(usb_task), NULL);
+    osThreadCreate(osThread(lighting_task), NULL);
+
+    osKernelStart();
+
+    // osKernelStart only returns if the kernel couldn't be started
+    error_panic(Error_RTOS_KernelStart);
+}
+#endif
 
 static void test() {
+    // Colour conversion throughput, see ledtests_color_benchmark
+    ledtests_color_benchmark();
+
     // usb comms test
     while (1) {
         tud_task();
 
-        send_sensor_update_usb();
+        sensor_report_send();
         for (uint8_t i = 0; i < 32; i++) {
             usb_sensor_buffer[i] = i;
         }
@@ -254,6 +600,8 @@ static void test() {
             }
         }
 
+        usb_consume_packet();
+
         if (all_good) {
             DBG_LED3_ON();
         }
@@ -4,12 +4,15 @@
 #include "req_queue.h"
 #include "error_handler.h"
 #include "config.h"
+#include "timebase.h"
+#include "events.h"
 
 #define RESPONSE_QUEUE_MAX (4U)
 #define RESPONSE_TIMEOUT_TICKS (2U)
 
 #define SEND_COMPLETE_MASK (0x01U)
 #define RECEIVE_COMPLETE_MASK (0x02U)
+#define FAULT_MASK (0x04U)
 
 // Public, so that contents can be inspected during debugging
 PortState port_state_left;
@@ -27,8 +30,14 @@ static int8_t queue_front = 0;
 static int8_t queue_rear = -1;
 static uint8_t queue_count = 0;
 
+// Nesting depth of main loop calls into msgbus. Interrupt handlers that want
+// to send a request check it first, since port state and the request queues
+// are only consistent while it is zero.
+static volatile uint8_t lock_depth = 0;
+
 static void switch_ports();
 static void start_request(Request *);
+static void send_request(Request);
 static PortState * get_port_state(ComportId);
 
 static void check_timeout(PortState *);
@@ -36,6 +45,9 @@ static void check_timeout(PortState *);
 // Should be given to uart as function pointers
 static void uart_on_send_complete(ComportId);
 static void uart_on_receive_complete(ComportId);
+static void uart_on_error(ComportId, uint32_t);
+
+static void recover_port(PortState *, ErrorCode, uint32_t);
 
 static void process_send_complete(PortState *);
 static void process_receive_complete(PortState *);
@@ -55,6 +67,7 @@ static inline Response create_response(
     resp.request_command = request_command;
     resp.data = data;
     resp.data_length = data_length;
+    resp.received_at = 0;
 
     return resp;
 }
@@ -75,6 +88,7 @@ static inline void init_port_state(
     state->current_request.comport_id = port;
     state->current_response = create_blank_response(port);
     state->interrupt_flags = 0x00;
+    state->last_fault = Error_None;
     req_queue_init(&state->req_queue);
 }
 
@@ -97,12 +111,36 @@ static inline void switch_ports_if_done() {
     }
 }
 
-static inline void expect_acknowledge(PortState * port_state) {
-    uart_receive(port_state->comport_id, port_state->acknowledged, 1);
+// Start transfers on a port, recovering it if they won't. Return whether
+// the transfer started; if not the port's request has been dropped.
+static inline uint8_t port_receive(
+    PortState * port_state, uint8_t * data, uint16_t len) {
+    HAL_StatusTypeDef result = uart_receive(port_state->comport_id, data, len);
+
+    if (result != HAL_OK) {
+        recover_port(port_state, Error_HAL_UART_Receive_DMA, result);
+    }
+
+    return result == HAL_OK;
 }
 
-static inline void expect_acknowledge_command(PortState * port_state) {
-    uart_receive(port_state->comport_id, port_state->acknowledged, 2);
+static inline uint8_t port_send(
+    PortState * port_state, uint8_t * data, uint16_t len) {
+    HAL_StatusTypeDef result = uart_send(port_state->comport_id, data, len);
+
+    if (result != HAL_OK) {
+        recover_port(port_state, Error_HAL_UART_Transmit_DMA, result);
+    }
+
+    return result == HAL_OK;
+}
+
+static inline uint8_t expect_acknowledge(PortState * port_state) {
+    return port_receive(port_state, port_state->acknowledged, 1);
+}
+
+static inline uint8_t expect_acknowledge_command(PortState * port_state) {
+    return port_receive(port_state, port_state->acknowledged, 2);
 }
 
 static inline uint8_t check_acknowledge(PortState * port_state) {
@@ -113,6 +151,12 @@ static inline uint8_t check_acknowledge(PortState * port_state) {
             && ack_cmd_was == port_state->current_request.request_command;
 }
 
+// Marks the port's request as done, having been acknowledged or answered
+static inline void complete_request(PortState * port_state) {
+    port_state->status = Status_Done;
+    port_state->completed_count++;
+}
+
 static inline void clear_acknowledge_command(PortState * port_state) {
     port_state->acknowledged[1] = Command_None;
 }
@@ -142,6 +186,14 @@ static inline void reset_receive_complete(PortState * port_state) {
     port_state->interrupt_flags &= ~RECEIVE_COMPLETE_MASK;
 }
 
+static inline uint8_t fault_is_set(PortState * port_state) {
+    return port_state->interrupt_flags & FAULT_MASK;
+}
+
+static inline void set_fault(PortState * port_state) {
+    port_state->interrupt_flags |= FAULT_MASK;
+}
+
 // Whether any of the ports have interrupt flags
 static inline uint8_t any_interrupt_flags() {
     return port_state_left.interrupt_flags 
@@ -153,6 +205,12 @@ static inline uint8_t any_interrupt_flags() {
 // Processes interrupt flags that were set since the last call,
 // set by a send and/or receive transaction completing
 static inline void process_flags(PortState * port_state) {
+    // A UART error leaves whatever else completed meaningless
+    if (fault_is_set(port_state)) {
+        recover_port(port_state, Error_HAL_UART_Error, port_state->uart_error);
+        return;
+    }
+
     // Note: it's important that process_send_complete is called before
     // process_receive_complete, for correct function of the state machine.
     if (send_complete_is_set(port_state)) {
@@ -189,27 +247,36 @@ void msgbus_init() {
 
     uart_set_on_send_complete_handler(uart_on_send_complete);
     uart_set_on_receive_complete_handler(uart_on_receive_complete);
+    uart_set_on_error_handler(uart_on_error);
 }
 
 void msgbus_process_flags() {
+    lock_depth++;
+
     if (!any_interrupt_flags()) {
         check_timeout(&port_state_left);
         check_timeout(&port_state_down);
         check_timeout(&port_state_up);
         check_timeout(&port_state_right);
-        switch_ports_if_done();
-        return;
+    } else {
+        process_flags(&port_state_left);
+        process_flags(&port_state_down);
+        process_flags(&port_state_up);
+        process_flags(&port_state_right);
     }
 
-    process_flags(&port_state_left);
-    process_flags(&port_state_down);
-    process_flags(&port_state_up);
-    process_flags(&port_state_right);
-
     switch_ports_if_done();
+
+    lock_depth--;
 }
 
 void msgbus_send_request(Request request) {
+    lock_depth++;
+    send_request(request);
+    lock_depth--;
+}
+
+static void send_request(Request request) {
     if (!panel_connected(request.comport_id)) return;
 
     PortState * portState = get_port_state(request.comport_id);
@@ -219,8 +286,9 @@ void msgbus_send_request(Request request) {
     if (portState->status != Status_Idle || !portState->selected) {
         // Only queue a request if it's not one that's currently being
         // executed
-        if (!request_equals(portState->current_request, request)) {
-            req_queue_add(&portState->req_queue, request);
+        if (!request_equals(portState->current_request, request)
+            && !req_queue_add(&portState->req_queue, request)) {
+            portState->queue_full_count++;
         }
 
         return;
@@ -241,13 +309,88 @@ Response * msgbus_get_pending_response() {
 }
 
 void msgbus_switch_ports_if_done() {
+    lock_depth++;
     switch_ports_if_done();
+    lock_depth--;
+}
+
+uint8_t msgbus_in_use() {
+    return lock_depth > 0;
+}
+
+uint8_t msgbus_port_ready(ComportId comport_id) {
+    PortState * port_state = get_port_state(comport_id);
+
+    return port_state->status == Status_Idle
+        && port_state->selected
+        && port_state->req_queue.count == 0;
 }
 
 PortStatus msgbus_port_status(ComportId comport_id) {
     return get_port_state(comport_id)->status;
 }
 
+uint32_t msgbus_timeout_count(ComportId comport_id) {
+    return get_port_state(comport_id)->timeout_count;
+}
+
+uint32_t msgbus_fault_count(ComportId comport_id) {
+    return get_port_state(comport_id)->fault_count;
+}
+
+uint32_t msgbus_completed_count(ComportId comport_id) {
+    return get_port_state(comport_id)->completed_count;
+}
+
+uint32_t msgbus_dropped_count(ComportId comport_id) {
+    PortState * port_state = get_port_state(comport_id);
+
+    return port_state->timeout_count
+        + port_state->fault_count
+        + port_state->queue_full_count
+        + port_state->flushed_count;
+}
+
+void msgbus_flush_port(ComportId comport_id) {
+    lock_depth++;
+
+    PortState * port_state = get_port_state(comport_id);
+
+    port_state->flushed_count += port_state->req_queue.count;
+    req_queue_init(&port_state->req_queue);
+
+    lock_depth--;
+}
+
+static inline uint8_t request_sends_from(
+    Request * req, const uint8_t * data, uint16_t len) {
+
+    return req->send_data_len > 0
+        && req->send_data >= data
+        && req->send_data < data + len;
+}
+
+uint8_t msgbus_sending_from(const uint8_t * data, uint16_t len) {
+    for (uint8_t i = 0; i <= COMPORT_ID_MAX; i++) {
+        PortState * port_state = port_states[i];
+
+        if (port_state->status != Status_Idle
+            && port_state->status != Status_Done
+            && request_sends_from(&port_state->current_request, data, len)) {
+            return true;
+        }
+
+        // Unused queue slots hold blank requests, which send nothing
+        for (uint8_t j = 0; j < MAX_REQ_QUEUE_LENGTH; j++) {
+            if (request_sends_from(&port_state->req_queue.items[j], data, len)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 void msgbus_wait_for_idle(ComportId comport_id) {
     PortState * port_state = get_port_state(comport_id);
 
@@ -262,10 +405,39 @@ void msgbus_wait_for_idle(ComportId comport_id) {
 // Callbacks for uart interrupts
 static void uart_on_send_complete(ComportId comport_id) {
     set_send_complete(get_port_state(comport_id));
+    events_post(EVENT_BUS);
 }
 
 static void uart_on_receive_complete(ComportId comport_id) {
-    set_receive_complete(get_port_state(comport_id));
+    PortState * port_state = get_port_state(comport_id);
+    port_state->received_at = timebase_us();
+    set_receive_complete(port_state);
+    events_post(EVENT_BUS);
+}
+
+static void uart_on_error(ComportId comport_id, uint32_t error) {
+    PortState * port_state = get_port_state(comport_id);
+    port_state->uart_error = error;
+    set_fault(port_state);
+    events_post(EVENT_BUS);
+}
+
+// Gets a port going again after something went wrong with its request,
+// instead of halting the whole bus: the request is dropped as if it had
+// timed out, and just this port's UART and DMA channels are reset, so the
+// next request starts clean. The other ports carry on throughout.
+static void recover_port(PortState * port_state, ErrorCode fault, uint32_t data) {
+    uart_reset_port(port_state->comport_id);
+
+    port_state->interrupt_flags = 0x00;
+    port_state->acknowledged[0] = 0x00;
+    port_state->last_fault = fault;
+    port_state->last_fault_data = data;
+    port_state->fault_count++;
+
+    if (port_state->status != Status_Idle) {
+        port_state->status = Status_Done;
+    }
 }
 
 // Process interrupt flags on main thread
@@ -302,8 +474,9 @@ static void process_send_complete(PortState * port_state) {
 
         default:
             // If we're getting this callback when not in either of the
-            // sending statuses, something is wrong. Panic.
-            error_panic_data(
+            // sending statuses, the port is out of step with the panel
+            recover_port(
+                port_state,
                 Error_App_MsgBus_SendCpltInvalidStatus,
                 port_state->status
             );
@@ -318,7 +491,8 @@ static void process_receive_complete(PortState * port_state) {
     switch (port_state->status) {
         case Status_Awaiting_Command_Ack:
             if (!check_acknowledge(port_state)) {
-                error_panic_data(
+                recover_port(
+                    port_state,
                     Error_App_MsgBus_RecvCpltNoAck,
                     Status_Awaiting_Command_Ack
                 );
@@ -330,29 +504,21 @@ static void process_receive_complete(PortState * port_state) {
             // We wouldn't be in awaiting ack state if we expected
             // a data response back without sending data out first.
             if (!request_has_data(req)) {
-                port_state->status = Status_Done;
+                complete_request(port_state);
                 break;
             }
 
             port_state->status = Status_Sending_Data;
 
             // If we also expect a response, set that up first now
-            if (request_expects_response(req)) {
-                uart_receive(
-                    port_state->comport_id,
-                    req->response_data,
-                    req->response_len
-                );
-            } else {
-                expect_acknowledge(port_state);
-            }
+            uint8_t receiving = request_expects_response(req)
+                ? port_receive(port_state, req->response_data, req->response_len)
+                : expect_acknowledge(port_state);
 
             // Send our data payload
-            uart_send(
-                port_state->comport_id,
-                req->send_data,
-                req->send_data_len
-            );
+            if (receiving) {
+                port_send(port_state, req->send_data, req->send_data_len);
+            }
             
             break;
 
@@ -360,7 +526,8 @@ static void process_receive_complete(PortState * port_state) {
             // If we get in this state at all, we're not expecting a data
             // response, so we can mark it done
             if (!check_acknowledge(port_state)) {
-                error_panic_data(
+                recover_port(
+                    port_state,
                     Error_App_MsgBus_RecvCpltNoAck,
                     Status_Awaiting_Data_Ack
                 );
@@ -368,7 +535,7 @@ static void process_receive_complete(PortState * port_state) {
                 break;
             }
 
-            port_state->status = Status_Done;
+            complete_request(port_state);
             break;
 
         case Status_Receiving:
@@ -378,14 +545,16 @@ static void process_receive_complete(PortState * port_state) {
                 req->response_data,
                 req->response_len
             );
+            port_state->current_response.received_at = port_state->received_at;
 
             queue_add(&port_state->current_response);
-            port_state->status = Status_Done;
+            complete_request(port_state);
             break;
 
         default:
-            // Not in one of the valid states, panic
-            error_panic_data(
+            // Not in one of the valid states, the port is out of step
+            recover_port(
+                port_state,
                 Error_App_MsgBus_RecvCpltInvalidStatus,
                 port_state->status
             );
@@ -453,22 +622,19 @@ static void start_request(Request * request) {
 
     port_state->status = Status_Sending_Command;
 
-    if (!request_has_data(request) && request_expects_response(request)) {
-        uart_receive(
-            request->comport_id,
-            request->response_data,
-            request->response_len
-        );
-    } else {
-        // Expect the command to be acknowledged if we:
-        //   either have more data to send, or don't have more data to send but
-        //   also don't expect a data response
-        // in essence, acknowledge is only redundant if we already expect the
-        // panel to send something back right after getting the command.
-        expect_acknowledge_command(port_state);
+    // Expect the command to be acknowledged if we:
+    //   either have more data to send, or don't have more data to send but
+    //   also don't expect a data response
+    // in essence, acknowledge is only redundant if we already expect the
+    // panel to send something back right after getting the command.
+    uint8_t receiving =
+        !request_has_data(request) && request_expects_response(request)
+        ? port_receive(port_state, request->response_data, request->response_len)
+        : expect_acknowledge_command(port_state);
+
+    if (receiving) {
+        port_send(port_state, (uint8_t *)&request->request_command, 1);
     }
-
-    uart_send(request->comport_id, &request->request_command, 1);
 }
 
 static void queue_add(Response * resp) {
@@ -0,0 +1,167 @@
+#include "panel_detect.h"
+#include "config.h"
+#include "msgbus.h"
+
+typedef struct {
+    PanelDetectState state;
+
+    // Fixed as connected in config.h, never probed or dropped
+    uint8_t forced;
+
+    // msgbus counts as of the last tick: requests completed, and requests
+    // lost to a timeout or fault
+    uint32_t completed;
+    uint32_t lost;
+
+    // Requests lost in a row while present
+    uint8_t failures;
+
+    // Time to wait before the next probe, and when it's due (HAL_GetTick)
+    uint16_t backoff_ms;
+    uint32_t next_probe;
+
+    // Last read of the CK "initialized" line
+    uint8_t initialized;
+} PanelHealth;
+
+static PanelHealth panels[COMPORT_ID_MAX + 1];
+static uint8_t found_mask = 0x00;
+static uint8_t lost_mask = 0x00;
+
+// Panels found and lost, and probes that went unanswered, per port
+// Public, so that contents can be inspected during debugging
+uint32_t panel_detect_found[COMPORT_ID_MAX + 1];
+uint32_t panel_detect_lost[COMPORT_ID_MAX + 1];
+uint32_t panel_detect_probes_failed[COMPORT_ID_MAX + 1];
+
+static inline void set_state(ComportId port, PanelDetectState state) {
+    panels[port].state = state;
+    _panels_connected[port] = state != PanelDetect_Absent;
+}
+
+static inline void probe(ComportId port) {
+    set_state(port, PanelDetect_Probing);
+}
+
+static void found(ComportId port) {
+    PanelHealth * panel = &panels[port];
+
+    set_state(port, PanelDetect_Present);
+    panel->failures = 0;
+    panel->backoff_ms = PANEL_DETECT_BACKOFF_MIN_MS;
+
+    found_mask |= 1 << port;
+    panel_detect_found[port]++;
+}
+
+// Stops talking to a panel until its next probe. Whatever was queued for it
+// would only time out in turn, so it's dropped.
+static void lose(ComportId port, uint32_t now) {
+    PanelHealth * panel = &panels[port];
+
+    if (panel->state == PanelDetect_Present) {
+        panel->backoff_ms = PANEL_DETECT_BACKOFF_MIN_MS;
+        lost_mask |= 1 << port;
+        panel_detect_lost[port]++;
+    } else {
+        panel->backoff_ms = panel->backoff_ms * 2 > PANEL_DETECT_BACKOFF_MAX_MS
+            ? PANEL_DETECT_BACKOFF_MAX_MS
+            : panel->backoff_ms * 2;
+        panel_detect_probes_failed[port]++;
+    }
+
+    set_state(port, PanelDetect_Absent);
+    panel->failures = 0;
+    panel->next_probe = now + panel->backoff_ms;
+
+    msgbus_flush_port(port);
+}
+
+void panel_detect_init() {
+    for (uint8_t i = 0; i <= COMPORT_ID_MAX; i++) {
+        ComportId port = (ComportId)i;
+        PanelHealth * panel = &panels[port];
+
+        panel->forced = _panels_connected[port];
+        panel->completed = msgbus_completed_count(port);
+        panel->lost = msgbus_timeout_count(port) + msgbus_fault_count(port);
+        panel->backoff_ms = PANEL_DETECT_BACKOFF_MIN_MS;
+        panel->initialized = uart_panel_initialized(port);
+
+        if (panel->forced || panel->initialized) {
+            found(port);
+        } else {
+            probe(port);
+        }
+    }
+}
+
+void panel_detect_task() {
+    uint32_t now = HAL_GetTick();
+
+    for (uint8_t i = 0; i <= COMPORT_ID_MAX; i++) {
+        ComportId port = (ComportId)i;
+        PanelHealth * panel = &panels[port];
+
+        if (panel->forced) continue;
+
+        uint32_t completed = msgbus_completed_count(port);
+        uint32_t lost = msgbus_timeout_count(port) + msgbus_fault_count(port);
+        uint8_t answered = completed != panel->completed;
+        uint32_t dropped = lost - panel->lost;
+
+        panel->completed = completed;
+        panel->lost = lost;
+
+        uint8_t initialized = uart_panel_initialized(port);
+        uint8_t raised = initialized && !panel->initialized;
+        panel->initialized = initialized;
+
+        switch (panel->state) {
+            case PanelDetect_Present:
+                if (answered) {
+                    panel->failures = 0;
+                } else if (dropped > 0) {
+                    panel->failures += dropped;
+
+                    if (panel->failures >= PANEL_DETECT_LOST_AFTER) {
+                        lose(port, now);
+                    }
+                }
+                break;
+
+            case PanelDetect_Probing:
+                if (answered) {
+                    found(port);
+                } else if (dropped > 0) {
+                    lose(port, now);
+                }
+                break;
+
+            case PanelDetect_Absent:
+                if (raised) {
+                    panel->backoff_ms = PANEL_DETECT_BACKOFF_MIN_MS;
+                    probe(port);
+                } else if ((int32_t)(now - panel->next_probe) >= 0) {
+                    probe(port);
+                }
+                break;
+        }
+    }
+}
+
+PanelDetectState panel_detect_state(ComportId port) {
+    return panels[port].state;
+}
+
+uint8_t panel_detect_take_found() {
+    uint8_t mask = found_mask;
+    found_mask = 0x00;
+    return mask;
+}
+
+uint8_t panel_detect_take_lost() {
+    uint8_t mask = lost_mask;
+    lost_mask = 0x00;
+    return mask;
+}
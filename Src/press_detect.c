@@ -0,0 +1,163 @@
+#include "press_detect.h"
+#include "sensor_report.h"
+#include "profile_config.h"
+
+static uint16_t press_threshold[SENSOR_COUNT];
+static uint16_t release_threshold[SENSOR_COUNT];
+static uint16_t panel_buttons[SENSOR_PANEL_COUNT];
+
+// Thresholds as pushed to the panels. Every profile load fills the other
+// buffer, so a push still being sent isn't changed under it and the new one
+// doesn't look like a duplicate to msgbus.
+static uint8_t panel_thresholds[2][SENSOR_PANEL_COUNT][PRESS_PANEL_THRESHOLDS_LEN];
+static uint8_t panel_thresholds_current = 0;
+
+// Written into by the panels via DMA
+static uint8_t mask_buffer[SENSOR_PANEL_COUNT];
+
+// Public, so that contents can be inspected during debugging
+volatile uint16_t pressed_sensors = 0;
+volatile uint8_t pressed_panels = 0;
+
+static inline uint16_t read_sensor(const uint8_t * data, uint8_t sensor) {
+    return data[sensor * 2] | (data[sensor * 2 + 1] << 8);
+}
+
+static inline void write_u16(uint8_t * dest, uint16_t value) {
+    dest[0] = value & 0xFF;
+    dest[1] = value >> 8;
+}
+
+static inline void set_panel_state(uint8_t panel, uint16_t sensors) {
+    uint16_t panel_mask =
+        ((1U << SENSORS_PER_PANEL) - 1) << (panel * SENSORS_PER_PANEL);
+
+    pressed_sensors = sensors;
+
+    if (sensors & panel_mask) {
+        pressed_panels |= 1U << panel;
+    } else {
+        pressed_panels &= ~(1U << panel);
+    }
+}
+
+// Panel keys select a gamepad button 1 to PRESS_BUTTON_COUNT. Anything else
+// (including the all-zero default profile) falls back to one button per
+// panel in ComportId order.
+static inline uint16_t key_to_button(uint8_t key, uint8_t panel) {
+    if (key >= 1 && key <= PRESS_BUTTON_COUNT) {
+        return 1U << (key - 1);
+    }
+
+    return 1U << panel;
+}
+
+void press_detect_load_profile(const uint8_t * profile) {
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        uint16_t threshold =
+            profile[PROFILE_THRESHOLDS_OFFSET + i] << PRESS_THRESHOLD_SHIFT;
+        uint16_t hysteresis =
+            profile[PROFILE_HYSTERESIS_OFFSET + i] << PRESS_THRESHOLD_SHIFT;
+
+        press_threshold[i] = threshold;
+        release_threshold[i] = hysteresis > threshold
+            ? 0
+            : threshold - hysteresis;
+    }
+
+    panel_thresholds_current ^= 1;
+
+    for (uint8_t panel = 0; panel < SENSOR_PANEL_COUNT; panel++) {
+        panel_buttons[panel] =
+            key_to_button(profile[PROFILE_PANEL_KEYS_OFFSET + panel], panel);
+
+        uint8_t * thresholds = panel_thresholds[panel_thresholds_current][panel];
+
+        for (uint8_t i = 0; i < SENSORS_PER_PANEL; i++) {
+            uint8_t sensor = panel * SENSORS_PER_PANEL + i;
+            write_u16(thresholds + i * 2, press_threshold[sensor]);
+            write_u16(
+                thresholds + (SENSORS_PER_PANEL + i) * 2,
+                release_threshold[sensor]
+            );
+        }
+    }
+
+    pressed_sensors = 0;
+    pressed_panels = 0;
+}
+
+void press_detect_update(ComportId comport_id, const uint8_t * data) {
+    uint8_t panel = (uint8_t)comport_id;
+    uint8_t first = panel * SENSORS_PER_PANEL;
+    uint16_t sensors = pressed_sensors;
+
+    for (uint8_t i = 0; i < SENSORS_PER_PANEL; i++) {
+        uint8_t sensor = first + i;
+        uint16_t bit = 1U << sensor;
+        uint16_t value = read_sensor(data, i);
+
+        // A threshold of 0 disables the sensor
+        if (press_threshold[sensor] == 0) {
+            sensors &= ~bit;
+        } else if (sensors & bit) {
+            if (value < release_threshold[sensor]) sensors &= ~bit;
+        } else {
+            if (value >= press_threshold[sensor]) sensors |= bit;
+        }
+    }
+
+    set_panel_state(panel, sensors);
+}
+
+void press_detect_update_mask(ComportId comport_id, uint8_t mask) {
+    uint8_t panel = (uint8_t)comport_id;
+    uint8_t first = panel * SENSORS_PER_PANEL;
+    uint16_t panel_mask = ((1U << SENSORS_PER_PANEL) - 1) << first;
+    uint16_t sensors = pressed_sensors & ~panel_mask;
+
+    for (uint8_t i = 0; i < SENSORS_PER_PANEL; i++) {
+        // The panel has the thresholds too, but a disabled sensor is
+        // ignored here either way
+        if ((mask & (1U << i)) && press_threshold[first + i] != 0) {
+            sensors |= 1U << (first + i);
+        }
+    }
+
+    set_panel_state(panel, sensors);
+}
+
+void press_detect_clear_panel(ComportId comport_id) {
+    uint8_t panel = (uint8_t)comport_id;
+    uint16_t panel_mask =
+        ((1U << SENSORS_PER_PANEL) - 1) << (panel * SENSORS_PER_PANEL);
+
+    set_panel_state(panel, pressed_sensors & ~panel_mask);
+}
+
+const uint8_t * press_detect_panel_thresholds(ComportId comport_id) {
+    return panel_thresholds[panel_thresholds_current][comport_id];
+}
+
+uint8_t * press_detect_mask_buffer(ComportId comport_id) {
+    return &mask_buffer[comport_id];
+}
+
+uint16_t press_detect_sensors() {
+    return pressed_sensors;
+}
+
+uint8_t press_detect_panels() {
+    return pressed_panels;
+}
+
+uint16_t press_detect_buttons() {
+    uint16_t buttons = 0;
+    uint8_t panels = pressed_panels;
+
+    for (uint8_t panel = 0; panel < SENSOR_PANEL_COUNT; panel++) {
+        if (panels & (1U << panel)) buttons |= panel_buttons[panel];
+    }
+
+    return buttons;
+}
@@ -1,7 +1,8 @@
 #include "profile_config.h"
 #include <string.h>   // For memcpy
+#include <stdbool.h>
 
-/* Default profile configuration (63 bytes) for use on checksum failure. */
+/* Default profile configuration (63 bytes) for slots without a valid profile. */
 #define PROFILE_CONFIG_DEFAULT { \
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, \
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, \
@@ -12,41 +13,118 @@
     0, 0, 0 \
 }
 
-HAL_StatusTypeDef profile_config_save(const uint8_t *data) {
+// Profiles saved before the record log: a 64-byte slot at the start of the
+// old config page, the 63 data bytes followed by their 8-bit sum
+static uint8_t read_legacy_profile(uint8_t *data) {
     uint8_t config[64];
     uint8_t checksum = 0;
 
-    // Copy the 63 data bytes into the temporary buffer.
-    memcpy(config, data, 63);
+    if (!epemul_read_legacy(config, 64)) {
+        return false;
+    }
 
-    // Compute the checksum as an 8-bit sum over the 63 bytes.
+    // Compute the checksum over the first 63 bytes.
     for (int i = 0; i < 63; i++) {
         checksum += config[i];
     }
-    // Store the checksum as the 64th byte.
-    config[63] = checksum;
 
-    // Write the complete 64-byte block to slot 0
-    return epemul_write_config_data(config, 0, 64);
+    if (checksum != config[63]) {
+        return false;
+    }
+
+    memcpy(data, config, 63);
+    return true;
 }
 
-void profile_config_read(uint8_t *data) {
-    uint8_t config[64];
-    uint8_t checksum = 0;
+// Every slot's profile, read from flash once at boot. Saves update it
+// straight away, so reads and switches never have to touch flash.
+static uint8_t profiles[PROFILE_SLOT_COUNT][PROFILE_DATA_LEN];
+static uint8_t active_slot = 0;
 
-    // Read the 64-byte profile from slot 0.
-    epemul_read_config_data(config, 0, 64);
+// Whether the active slot has changed since it was last queued to be
+// saved, and when (HAL_GetTick) it last changed
+static uint8_t active_slot_dirty = false;
+static uint32_t active_slot_changed_at = 0;
 
-    // Compute the checksum over the first 63 bytes.
-    for (int i = 0; i < 63; i++) {
-        checksum += config[i];
+// Returns whether the profile came from the legacy copy
+static uint8_t read_slot(uint8_t slot, uint8_t *data) {
+    if (epemul_read_record(PROFILE_SLOT_KEY(slot), data, PROFILE_DATA_LEN) == PROFILE_DATA_LEN) {
+        return false;
     }
-    
-    // If the checksum does not match, use the default profile.
-    if (checksum != config[63]) {
-        static const uint8_t default_profile[63] = PROFILE_CONFIG_DEFAULT;
-        memcpy(data, default_profile, 63);
-    } else {
-        memcpy(data, config, 63);
+
+    // Only slot 0 existed before the record log
+    if (slot == 0 && read_legacy_profile(data)) {
+        return true;
+    }
+
+    // If there is no valid profile, use the default one.
+    static const uint8_t default_profile[63] = PROFILE_CONFIG_DEFAULT;
+    memcpy(data, default_profile, 63);
+    return false;
+}
+
+void profile_config_init(void) {
+    for (uint8_t slot = 0; slot < PROFILE_SLOT_COUNT; slot++) {
+        // The legacy copy sits on the log's second page, which the first
+        // compaction erases. Move it into the log before that happens.
+        if (read_slot(slot, profiles[slot])) {
+            epemul_queue_record(PROFILE_SLOT_KEY(slot), profiles[slot], PROFILE_DATA_LEN, NULL);
+        }
+    }
+
+    uint8_t slot;
+    if (epemul_read_record(PROFILE_ACTIVE_KEY, &slot, 1) == 1 && slot < PROFILE_SLOT_COUNT) {
+        active_slot = slot;
+    }
+}
+
+HAL_StatusTypeDef profile_config_save(uint8_t slot, const uint8_t *data, EpemulWriteDone done) {
+    if (slot >= PROFILE_SLOT_COUNT) {
+        return HAL_ERROR;
+    }
+
+    memcpy(profiles[slot], data, PROFILE_DATA_LEN);
+
+    // The record log checks the data itself, no checksum needed
+    return epemul_queue_record(PROFILE_SLOT_KEY(slot), data, PROFILE_DATA_LEN, done);
+}
+
+const uint8_t *profile_config_get(uint8_t slot) {
+    return profiles[slot < PROFILE_SLOT_COUNT ? slot : 0];
+}
+
+const uint8_t *profile_config_active(void) {
+    return profiles[active_slot];
+}
+
+uint8_t profile_config_active_slot(void) {
+    return active_slot;
+}
+
+bool profile_config_switch(uint8_t slot) {
+    if (slot >= PROFILE_SLOT_COUNT) {
+        return false;
+    }
+
+    if (slot != active_slot) {
+        active_slot = slot;
+        active_slot_dirty = true;
+        active_slot_changed_at = HAL_GetTick();
+    }
+
+    return true;
+}
+
+void profile_config_task(void) {
+    if (!active_slot_dirty
+        || HAL_GetTick() - active_slot_changed_at < PROFILE_ACTIVE_SAVE_DELAY_MS) {
+        return;
+    }
+
+    // If the queue is full, try again on the next call. Switching back to
+    // the saved slot in the meantime costs no write, as the log skips
+    // records that match the newest one.
+    if (epemul_queue_record(PROFILE_ACTIVE_KEY, &active_slot, 1, NULL) == HAL_OK) {
+        active_slot_dirty = false;
     }
 }
@@ -1,7 +1,6 @@
 #include "uart.h"
 #include "stdbool.h"
 #include "req_queue.h"
-#include "error_handler.h"
 
 Request BlankRequest = {
     Comport_None,
@@ -32,20 +31,18 @@ void req_queue_init(RequestQueue * queue) {
     }
 }
 
-void req_queue_add(RequestQueue * queue, Request request) {
-    if (queue->count == MAX_REQ_QUEUE_LENGTH) {
-        error_panic(Error_App_ReqQueue_QueueFull);
-        return;
-    }
-
+uint8_t req_queue_add(RequestQueue * queue, Request request) {
     // Don't add if the request is already in the queue
-    if (contains(queue, request)) return;
+    if (contains(queue, request)) return true;
+
+    if (queue->count == MAX_REQ_QUEUE_LENGTH) return false;
 
     if (queue->rear == MAX_REQ_QUEUE_LENGTH - 1) queue->rear = -1;
 
     queue->rear++;
     queue->items[queue->rear] = request;
     queue->count++;
+    return true;
 }
 
 Request req_queue_take(RequestQueue * queue) {
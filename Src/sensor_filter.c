@@ -0,0 +1,211 @@
+#include "sensor_filter.h"
+#include "sensor_report.h"
+#include "profile_config.h"
+#include "timebase.h"
+#include "arm_math.h"
+
+#define EMA_DEFAULT_ALPHA (64U)
+#define BIQUAD_DEFAULT_CUTOFF (26U)
+#define BIQUAD_Q (0.70710678f)
+
+// Filter state is kept as one array per quantity, indexed by sensor, so each
+// filter step is a handful of CMSIS-DSP vector operations over a panel's
+// sensors rather than a loop of scalar code per sensor.
+static SensorFilterType filter_type[SENSOR_COUNT];
+static uint8_t panel_uses[SENSOR_PANEL_COUNT];
+static uint8_t panel_primed[SENSOR_PANEL_COUNT];
+
+static float32_t ema_alpha;
+static float32_t ema_state[SENSOR_COUNT];
+
+static uint8_t median_window;
+static uint8_t median_index[SENSOR_PANEL_COUNT];
+static float32_t median_history[SENSOR_FILTER_MEDIAN_MAX][SENSOR_COUNT];
+static float32_t median_out[SENSOR_COUNT];
+
+// Shared coefficients, per-sensor delay lines (direct form I)
+static float32_t biquad_b0, biquad_b1, biquad_b2, biquad_a1, biquad_a2;
+static float32_t biquad_x1[SENSOR_COUNT], biquad_x2[SENSOR_COUNT];
+static float32_t biquad_y1[SENSOR_COUNT], biquad_y2[SENSOR_COUNT];
+static float32_t biquad_out[SENSOR_COUNT];
+
+// Cycles taken by the last and slowest call to sensor_filter_apply.
+// Public, so that contents can be inspected during debugging
+volatile uint32_t sensor_filter_cycles_last = 0;
+volatile uint32_t sensor_filter_cycles_max = 0;
+
+static inline uint16_t read_sensor(const uint8_t * data, uint8_t sensor) {
+    return data[sensor * 2] | (data[sensor * 2 + 1] << 8);
+}
+
+static inline void write_sensor(uint8_t * data, uint8_t sensor, float32_t v) {
+    uint16_t value = v <= 0.0f ? 0 : v >= 65535.0f ? 0xFFFF : v + 0.5f;
+    data[sensor * 2] = value & 0xFF;
+    data[sensor * 2 + 1] = value >> 8;
+}
+
+// RBJ cookbook low-pass, cutoff as a fraction of the sample rate
+static void design_biquad(float32_t cutoff) {
+    float32_t w0 = 2.0f * PI * cutoff;
+    float32_t cos_w0 = arm_cos_f32(w0);
+    float32_t alpha = arm_sin_f32(w0) / (2.0f * BIQUAD_Q);
+    float32_t a0 = 1.0f + alpha;
+
+    biquad_b0 = (1.0f - cos_w0) / 2.0f / a0;
+    biquad_b1 = (1.0f - cos_w0) / a0;
+    biquad_b2 = biquad_b0;
+    biquad_a1 = -2.0f * cos_w0 / a0;
+    biquad_a2 = (1.0f - alpha) / a0;
+}
+
+static inline float32_t median_of(float32_t * v, uint8_t n) {
+    // Insertion sort, n is at most SENSOR_FILTER_MEDIAN_MAX
+    for (uint8_t i = 1; i < n; i++) {
+        float32_t key = v[i];
+        int8_t j = i - 1;
+
+        while (j >= 0 && v[j] > key) {
+            v[j + 1] = v[j];
+            j--;
+        }
+
+        v[j + 1] = key;
+    }
+
+    return v[n / 2];
+}
+
+// Sets all state for a panel's sensors to the given readings, so filters
+// start settled instead of ramping up from zero
+static void prime_panel(uint8_t first, float32_t * x) {
+    arm_copy_f32(x, ema_state + first, SENSORS_PER_PANEL);
+    arm_copy_f32(x, biquad_x1 + first, SENSORS_PER_PANEL);
+    arm_copy_f32(x, biquad_x2 + first, SENSORS_PER_PANEL);
+    arm_copy_f32(x, biquad_y1 + first, SENSORS_PER_PANEL);
+    arm_copy_f32(x, biquad_y2 + first, SENSORS_PER_PANEL);
+
+    for (uint8_t i = 0; i < SENSOR_FILTER_MEDIAN_MAX; i++) {
+        arm_copy_f32(x, median_history[i] + first, SENSORS_PER_PANEL);
+    }
+}
+
+static void step_ema(uint8_t first, float32_t * x) {
+    float32_t delta[SENSORS_PER_PANEL];
+    float32_t * y = ema_state + first;
+
+    // y += alpha * (x - y)
+    arm_sub_f32(x, y, delta, SENSORS_PER_PANEL);
+    arm_scale_f32(delta, ema_alpha, delta, SENSORS_PER_PANEL);
+    arm_add_f32(y, delta, y, SENSORS_PER_PANEL);
+}
+
+static void step_median(uint8_t panel, uint8_t first, float32_t * x) {
+    uint8_t slot = median_index[panel];
+    arm_copy_f32(x, median_history[slot] + first, SENSORS_PER_PANEL);
+    median_index[panel] = (slot + 1) % median_window;
+
+    for (uint8_t i = 0; i < SENSORS_PER_PANEL; i++) {
+        float32_t window[SENSOR_FILTER_MEDIAN_MAX];
+
+        for (uint8_t s = 0; s < median_window; s++) {
+            window[s] = median_history[s][first + i];
+        }
+
+        median_out[first + i] = median_of(window, median_window);
+    }
+}
+
+static void step_biquad(uint8_t first, float32_t * x) {
+    float32_t term[SENSORS_PER_PANEL];
+    float32_t * y = biquad_out + first;
+    float32_t * x1 = biquad_x1 + first;
+    float32_t * x2 = biquad_x2 + first;
+    float32_t * y1 = biquad_y1 + first;
+    float32_t * y2 = biquad_y2 + first;
+
+    // y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2
+    arm_scale_f32(x, biquad_b0, y, SENSORS_PER_PANEL);
+    arm_scale_f32(x1, biquad_b1, term, SENSORS_PER_PANEL);
+    arm_add_f32(y, term, y, SENSORS_PER_PANEL);
+    arm_scale_f32(x2, biquad_b2, term, SENSORS_PER_PANEL);
+    arm_add_f32(y, term, y, SENSORS_PER_PANEL);
+    arm_scale_f32(y1, biquad_a1, term, SENSORS_PER_PANEL);
+    arm_sub_f32(y, term, y, SENSORS_PER_PANEL);
+    arm_scale_f32(y2, biquad_a2, term, SENSORS_PER_PANEL);
+    arm_sub_f32(y, term, y, SENSORS_PER_PANEL);
+
+    arm_copy_f32(x1, x2, SENSORS_PER_PANEL);
+    arm_copy_f32(x, x1, SENSORS_PER_PANEL);
+    arm_copy_f32(y1, y2, SENSORS_PER_PANEL);
+    arm_copy_f32(y, y1, SENSORS_PER_PANEL);
+}
+
+void sensor_filter_load_profile(const uint8_t * profile) {
+    for (uint8_t panel = 0; panel < SENSOR_PANEL_COUNT; panel++) {
+        panel_uses[panel] = 0;
+        panel_primed[panel] = false;
+        median_index[panel] = 0;
+    }
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        uint8_t packed = profile[PROFILE_FILTER_TYPES_OFFSET + i / 2];
+        uint8_t type = (i & 1) ? packed >> 4 : packed & 0x0F;
+
+        if (type > SensorFilter_Biquad) type = SensorFilter_None;
+
+        filter_type[i] = (SensorFilterType)type;
+        panel_uses[i / SENSORS_PER_PANEL] |= 1U << type;
+    }
+
+    uint8_t alpha = profile[PROFILE_FILTER_EMA_OFFSET];
+    ema_alpha = (alpha == 0 ? EMA_DEFAULT_ALPHA : alpha) / 256.0f;
+
+    median_window = profile[PROFILE_FILTER_MEDIAN_OFFSET] == 5 ? 5 : 3;
+
+    uint8_t cutoff = profile[PROFILE_FILTER_BIQUAD_OFFSET];
+    // Keep below Nyquist, the design falls apart at and above it
+    if (cutoff == 0 || cutoff >= 128) cutoff = BIQUAD_DEFAULT_CUTOFF;
+    design_biquad(cutoff / 256.0f);
+}
+
+void sensor_filter_apply(ComportId comport_id, uint8_t * data) {
+    uint8_t panel = (uint8_t)comport_id;
+    uint8_t uses = panel_uses[panel];
+
+    if (!(uses & ~(1U << SensorFilter_None))) return;
+
+    uint32_t start = timebase_cycles();
+    uint8_t first = panel * SENSORS_PER_PANEL;
+    float32_t x[SENSORS_PER_PANEL];
+
+    for (uint8_t i = 0; i < SENSORS_PER_PANEL; i++) {
+        x[i] = read_sensor(data, i);
+    }
+
+    if (!panel_primed[panel]) {
+        prime_panel(first, x);
+        panel_primed[panel] = true;
+    }
+
+    if (uses & (1U << SensorFilter_EMA)) step_ema(first, x);
+    if (uses & (1U << SensorFilter_Median)) step_median(panel, first, x);
+    if (uses & (1U << SensorFilter_Biquad)) step_biquad(first, x);
+
+    for (uint8_t i = 0; i < SENSORS_PER_PANEL; i++) {
+        switch (filter_type[first + i]) {
+            case SensorFilter_EMA:
+                write_sensor(data, i, ema_state[first + i]);
+                break;
+            case SensorFilter_Median:
+                write_sensor(data, i, median_out[first + i]);
+                break;
+            case SensorFilter_Biquad:
+                write_sensor(data, i, biquad_out[first + i]);
+                break;
+        }
+    }
+
+    uint32_t cycles = timebase_cycles() - start;
+    sensor_filter_cycles_last = cycles;
+    if (cycles > sensor_filter_cycles_max) sensor_filter_cycles_max = cycles;
+}
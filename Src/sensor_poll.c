@@ -0,0 +1,185 @@
+#include "sensor_poll.h"
+#include "stm32f3xx_hal.h"
+#include "profile_config.h"
+#include "error_handler.h"
+#include "msgbus.h"
+#include "events.h"
+#include "timebase.h"
+#include "config.h"
+#include "sensor_report.h"
+
+#define SENSOR_POLL_TICK_HZ (1000000U)
+
+// Achieved rates are worked out over windows of this length
+#define SENSOR_POLL_WINDOW_US (1000000U)
+
+TIM_HandleTypeDef htim6_sensor_poll;
+
+static const uint8_t poll_rates_khz[] = SENSOR_POLL_RATES_KHZ;
+
+static volatile uint32_t tick_count = 0;
+static uint32_t ticks_handled = 0;
+
+// Whether each port has a poll out that wasn't answered yet, and the port's
+// msgbus dropped request count when it was sent, so a poll that timed out or
+// was lost to a fault frees the port
+static uint8_t outstanding[SENSOR_PANEL_COUNT];
+static uint32_t outstanding_dropped[SENSOR_PANEL_COUNT];
+
+// One poll in this many fetches full readings, the rest press masks.
+// 0 or 1 fetches full readings every time.
+static uint8_t full_poll_interval = 0;
+
+// Press mask polls answered since the port's last full readings. Counting
+// answers rather than polls sent keeps repeated polls for a port that
+// msgbus dropped as duplicates from skewing the mix.
+static uint8_t masks_since_full[SENSOR_PANEL_COUNT];
+
+static uint32_t window_start = 0;
+static uint32_t window_responses[SENSOR_PANEL_COUNT];
+
+// Target poll rate in Hz (0 when free-running), the rate each port achieved
+// over the last window, polls issued and skipped because the previous one
+// was still out, and timer ticks the main loop didn't get to in time.
+// Public, so that contents can be inspected during debugging
+uint32_t sensor_poll_target_hz = 0;
+uint32_t sensor_poll_achieved_hz[SENSOR_PANEL_COUNT];
+uint32_t sensor_poll_issued[SENSOR_PANEL_COUNT];
+uint32_t sensor_poll_overruns[SENSOR_PANEL_COUNT];
+uint32_t sensor_poll_masks_answered[SENSOR_PANEL_COUNT];
+uint32_t sensor_poll_ticks_missed = 0;
+
+static inline uint32_t rate_from_profile(uint8_t value) {
+    for (uint8_t i = 0; i < sizeof(poll_rates_khz); i++) {
+        if (value == poll_rates_khz[i]) return value * 1000U;
+    }
+
+    return 0;
+}
+
+static void stop_timer(void) {
+    HAL_TIM_Base_Stop_IT(&htim6_sensor_poll);
+}
+
+static void start_timer(uint32_t rate_hz) {
+    // APB1 is divided down, so the timer kernel clock is twice PCLK1
+    uint32_t timer_clock = HAL_RCC_GetPCLK1Freq() * 2;
+
+    htim6_sensor_poll.Instance = TIM6;
+    htim6_sensor_poll.Init.Prescaler = (timer_clock / SENSOR_POLL_TICK_HZ) - 1;
+    htim6_sensor_poll.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim6_sensor_poll.Init.Period = (SENSOR_POLL_TICK_HZ / rate_hz) - 1;
+    htim6_sensor_poll.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    htim6_sensor_poll.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+
+    if (HAL_TIM_Base_Init(&htim6_sensor_poll) != HAL_OK) {
+        error_panic(Error_HAL_TIM_Init);
+    }
+
+    if (HAL_TIM_Base_Start_IT(&htim6_sensor_poll) != HAL_OK) {
+        error_panic(Error_HAL_TIM_Start);
+    }
+}
+
+void sensor_poll_load_profile(const uint8_t * profile) {
+    uint32_t rate_hz = rate_from_profile(profile[PROFILE_SENSOR_POLL_RATE_OFFSET]);
+
+    full_poll_interval = profile[PROFILE_SENSOR_FULL_POLL_OFFSET];
+    for (uint8_t i = 0; i < SENSOR_PANEL_COUNT; i++) {
+        masks_since_full[i] = 0;
+    }
+
+    if (rate_hz == sensor_poll_target_hz) return;
+
+    if (sensor_poll_target_hz != 0) {
+        stop_timer();
+    }
+
+    sensor_poll_target_hz = rate_hz;
+    ticks_handled = tick_count;
+
+    for (uint8_t i = 0; i < SENSOR_PANEL_COUNT; i++) {
+        outstanding[i] = false;
+    }
+
+    if (rate_hz != 0) {
+        start_timer(rate_hz);
+    }
+}
+
+uint8_t sensor_poll_free_running() {
+    return sensor_poll_target_hz == 0;
+}
+
+void sensor_poll_begin() {
+    uint32_t ticks = tick_count;
+
+    if (ticks - ticks_handled > 1) {
+        sensor_poll_ticks_missed += ticks - ticks_handled - 1;
+    }
+
+    ticks_handled = ticks;
+}
+
+uint8_t sensor_poll_start(ComportId comport_id) {
+    if (!panel_connected(comport_id)) return false;
+
+    uint8_t port = (uint8_t)comport_id;
+
+    if (outstanding[port]
+        && msgbus_dropped_count(comport_id) == outstanding_dropped[port]) {
+        sensor_poll_overruns[port]++;
+        return false;
+    }
+
+    outstanding[port] = true;
+    outstanding_dropped[port] = msgbus_dropped_count(comport_id);
+    sensor_poll_issued[port]++;
+    return true;
+}
+
+uint8_t sensor_poll_uses_press_masks() {
+    return full_poll_interval > 1;
+}
+
+uint8_t sensor_poll_next_is_full(ComportId comport_id) {
+    return full_poll_interval <= 1
+        || masks_since_full[comport_id] + 1 >= full_poll_interval;
+}
+
+uint32_t sensor_poll_rate_achieved(ComportId comport_id) {
+    return sensor_poll_achieved_hz[comport_id];
+}
+
+void sensor_poll_answered(ComportId comport_id, uint8_t full) {
+    uint32_t now = timebase_us();
+    uint32_t elapsed = now - window_start;
+
+    outstanding[comport_id] = false;
+    window_responses[comport_id]++;
+
+    if (full) {
+        masks_since_full[comport_id] = 0;
+    } else {
+        masks_since_full[comport_id]++;
+        sensor_poll_masks_answered[comport_id]++;
+    }
+
+    if (elapsed < SENSOR_POLL_WINDOW_US) return;
+
+    for (uint8_t i = 0; i < SENSOR_PANEL_COUNT; i++) {
+        sensor_poll_achieved_hz[i] =
+            (uint64_t)window_responses[i] * SENSOR_POLL_TICK_HZ / elapsed;
+        window_responses[i] = 0;
+    }
+
+    window_start = now;
+}
+
+// Invoked by the HAL from the TIM6 interrupt
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef * htim) {
+    if (htim->Instance != TIM6) return;
+
+    tick_count++;
+    events_post(EVENT_POLL);
+}
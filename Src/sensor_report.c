@@ -0,0 +1,243 @@
+#include "sensor_report.h"
+#include "timebase.h"
+#include "usb_sof.h"
+#include "tusb.h"
+#include "tusb_hid.h"
+#include "events.h"
+#include "profile_config.h"
+#include "press_detect.h"
+#include "hid_protocol.h"
+#include "string.h"
+
+#define SOF_INTERVAL_US (1000U)
+
+// Profile lead time units
+#define REPORT_LEAD_UNIT_US (10U)
+
+// In-token phase average, with this many fractional bits, and the weight of
+// each new measurement as a shift
+#define PHASE_SHIFT (4U)
+#define PHASE_AVERAGE_SHIFT (3U)
+
+// Extra lead added for every report that misses its token, the most it can
+// grow to, and how many reports in a row must be on time to take a step off
+#define EXTRA_LEAD_STEP_US (20U)
+#define EXTRA_LEAD_MAX_US (500U)
+#define EXTRA_LEAD_RECOVER_REPORTS (64U)
+
+// Written into by the panels via DMA
+uint8_t sensor_buffer[SENSOR_REPORT_SIZE];
+uint8_t usb_sensor_buffer[SENSOR_REPORT_SIZE];
+
+static uint32_t report_sequence = 0;
+static uint32_t sample_received_at[SENSOR_PANEL_COUNT];
+static uint8_t sample_valid[SENSOR_PANEL_COUNT];
+static uint8_t sample_reported[SENSOR_PANEL_COUNT];
+
+// Time from a panel's data arriving to the first report carrying it being
+// queued, in microseconds. This is the sensor path's latency through the
+// firmware, whichever way the work is scheduled.
+// Public, so that contents can be inspected during debugging
+uint32_t sensor_path_latency_last = 0;
+uint32_t sensor_path_latency_max = 0;
+
+static uint16_t report_lead = 0;
+static uint16_t extra_lead = 0;
+static uint16_t on_time_streak = 0;
+static uint32_t in_phase_average = 0;
+static uint8_t in_phase_known = false;
+
+// Set while a report is on the IN endpoint, with the frame it was queued in
+static volatile uint8_t report_pending = false;
+static volatile uint16_t report_frame;
+
+// When the IN token is expected after SOF, the alarm's time after SOF, and
+// reports that made or missed their intended token.
+// Public, so that contents can be inspected during debugging
+volatile uint32_t sensor_report_in_phase = 0;
+volatile uint32_t sensor_report_alarm_offset = 0;
+volatile uint32_t sensor_report_on_time = 0;
+volatile uint32_t sensor_report_late = 0;
+
+static inline void put_u16(uint8_t * dest, uint16_t value) {
+    dest[0] = value & 0xFF;
+    dest[1] = value >> 8;
+}
+
+static inline void put_u32(uint8_t * dest, uint32_t value) {
+    dest[0] = value & 0xFF;
+    dest[1] = (value >> 8) & 0xFF;
+    dest[2] = (value >> 16) & 0xFF;
+    dest[3] = value >> 24;
+}
+
+static inline uint16_t saturate_u16(uint32_t value) {
+    return value > 0xFFFF ? 0xFFFF : value;
+}
+
+uint8_t * sensor_report_poll_buffer(ComportId comport_id) {
+    return sensor_buffer + ((uint8_t)comport_id) * SENSOR_RESPONSE_LEN;
+}
+
+void sensor_report_store(Response * resp) {
+    uint8_t offset = SENSOR_REPORT_DATA_OFFSET
+        + (uint8_t)resp->comport_id * SENSOR_RESPONSE_LEN;
+
+    // Copy data over into usb sensor array
+    for (uint8_t i = 0; i < resp->data_length; i++) {
+        usb_sensor_buffer[offset + i] = resp->data[i];
+    }
+
+    sample_received_at[resp->comport_id] = resp->received_at;
+    sample_valid[resp->comport_id] = true;
+    sample_reported[resp->comport_id] = false;
+}
+
+void sensor_report_store_mask(Response * resp) {
+    sample_received_at[resp->comport_id] = resp->received_at;
+    sample_valid[resp->comport_id] = true;
+    sample_reported[resp->comport_id] = false;
+}
+
+void sensor_report_clear_panel(ComportId comport_id) {
+    uint8_t offset = SENSOR_REPORT_DATA_OFFSET
+        + (uint8_t)comport_id * SENSOR_RESPONSE_LEN;
+
+    for (uint8_t i = 0; i < SENSOR_RESPONSE_LEN; i++) {
+        usb_sensor_buffer[offset + i] = 0;
+    }
+
+    sample_valid[comport_id] = false;
+}
+
+uint8_t sensor_report_send() {
+    if (!tud_hid_ready()) return false;
+
+    uint32_t now = timebase_us();
+
+    put_u32(usb_sensor_buffer + SENSOR_REPORT_SEQUENCE_OFFSET, report_sequence);
+    put_u32(usb_sensor_buffer + SENSOR_REPORT_TIMESTAMP_OFFSET, now);
+    put_u16(usb_sensor_buffer + SENSOR_REPORT_SOF_FRAME_OFFSET, usb_sof_frame());
+    put_u16(
+        usb_sensor_buffer + SENSOR_REPORT_SOF_OFFSET_OFFSET,
+        saturate_u16(now - usb_sof_timestamp())
+    );
+
+    put_u16(usb_sensor_buffer + SENSOR_REPORT_PRESSED_OFFSET, press_detect_sensors());
+
+    for (uint8_t panel = 0; panel < SENSOR_PANEL_COUNT; panel++) {
+        uint16_t age = sample_valid[panel]
+            ? saturate_u16(now - sample_received_at[panel])
+            : SENSOR_REPORT_AGE_UNKNOWN;
+
+        put_u16(usb_sensor_buffer + SENSOR_REPORT_AGE_OFFSET + panel * 2, age);
+    }
+
+    report_frame = usb_sof_frame();
+    report_pending = true;
+
+    uint8_t queued;
+    if (hid_protocol_version() == HID_PROTOCOL_LEGACY) {
+        queued = tud_hid_report(
+            USB_SEND_REPORT_ID, usb_sensor_buffer, SENSOR_REPORT_SIZE);
+    } else {
+        // Typed sessions tell reports from replies by their first byte. The
+        // last byte of the report is reserved, so nothing is lost.
+        uint8_t typed[SENSOR_REPORT_SIZE];
+        typed[0] = HID_PACKET_SENSOR_REPORT;
+        memcpy(typed + 1, usb_sensor_buffer, SENSOR_REPORT_SIZE - 1);
+        queued = tud_hid_report(USB_SEND_REPORT_ID, typed, SENSOR_REPORT_SIZE);
+    }
+
+    if (!queued) {
+        report_pending = false;
+        return false;
+    }
+
+    for (uint8_t panel = 0; panel < SENSOR_PANEL_COUNT; panel++) {
+        if (!sample_valid[panel] || sample_reported[panel]) continue;
+
+        uint32_t latency = now - sample_received_at[panel];
+        sensor_path_latency_last = latency;
+        if (latency > sensor_path_latency_max) {
+            sensor_path_latency_max = latency;
+        }
+
+        sample_reported[panel] = true;
+    }
+
+    report_sequence++;
+    return true;
+}
+
+void sensor_report_load_profile(const uint8_t * profile) {
+    report_lead = profile[PROFILE_SENSOR_REPORT_LEAD_OFFSET] * REPORT_LEAD_UNIT_US;
+    extra_lead = 0;
+    on_time_streak = 0;
+}
+
+uint8_t sensor_report_aligned() {
+    return report_lead != 0;
+}
+
+static void report_alarm(void) {
+    events_post(EVENT_REPORT);
+}
+
+void sensor_report_on_sof() {
+    if (report_lead == 0) return;
+
+    uint32_t lead = report_lead + extra_lead;
+    uint32_t offset = 0;
+
+    // Until the first IN transfer completes, go right at SOF
+    if (in_phase_known && sensor_report_in_phase > lead) {
+        offset = sensor_report_in_phase - lead;
+    }
+
+    sensor_report_alarm_offset = offset;
+    timebase_set_alarm(usb_sof_timestamp() + offset, report_alarm);
+}
+
+void sensor_report_on_sent() {
+    uint32_t phase = timebase_us() - usb_sof_timestamp();
+
+    // A missed SOF would make this look like a late token
+    if (phase < SOF_INTERVAL_US) {
+        if (in_phase_known) {
+            in_phase_average +=
+                (int32_t)((phase << PHASE_SHIFT) - in_phase_average)
+                >> PHASE_AVERAGE_SHIFT;
+        } else {
+            in_phase_average = phase << PHASE_SHIFT;
+            in_phase_known = true;
+        }
+
+        sensor_report_in_phase = in_phase_average >> PHASE_SHIFT;
+    }
+
+    if (!report_pending) return;
+    report_pending = false;
+
+    // Reports sent as soon as data is in have no token to make
+    if (report_lead == 0) return;
+
+    // Taken in a later frame than it was queued in: the token it was meant
+    // for had already gone by
+    if (usb_sof_frame() != report_frame) {
+        sensor_report_late++;
+        on_time_streak = 0;
+
+        if (extra_lead + EXTRA_LEAD_STEP_US <= EXTRA_LEAD_MAX_US) {
+            extra_lead += EXTRA_LEAD_STEP_US;
+        }
+        return;
+    }
+
+    sensor_report_on_time++;
+
+    if (extra_lead > 0 && ++on_time_streak >= EXTRA_LEAD_RECOVER_REPORTS) {
+        on_time_streak = 0;
+        extra_lead -= EXTRA_LEAD_STEP_US;
+    }
+}
@@ -218,4 +218,19 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart) {
         HAL_DMA_DeInit(huart->hdmarx);
         HAL_DMA_DeInit(huart->hdmatx);
     }
-}
\ No newline at end of file
+}
+
+// TIM MSP Initialization
+// Only needs to enable the clocks and interrupts; none of our timers drive
+// any pins
+void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* htim) {
+    if (htim->Instance == TIM2) {
+        __HAL_RCC_TIM2_CLK_ENABLE();
+        HAL_NVIC_SetPriority(TIM2_IRQn, 0, 0);
+        HAL_NVIC_EnableIRQ(TIM2_IRQn);
+    } else if (htim->Instance == TIM6) {
+        __HAL_RCC_TIM6_CLK_ENABLE();
+        HAL_NVIC_SetPriority(TIM6_DAC_IRQn, 0, 0);
+        HAL_NVIC_EnableIRQ(TIM6_DAC_IRQn);
+    }
+}
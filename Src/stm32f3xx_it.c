@@ -19,6 +19,13 @@
 #include "uart.h"
 #include "stm32f3xx_it.h"
 #include "error_handler.h"
+#include "events.h"
+
+#ifdef USE_CMSIS_RTOS
+// Kernel tick, for CMSIS-RTOS implementations that leave the SysTick vector
+// to the application (such as ST's FreeRTOS wrapper)
+extern void osSystickHandler(void);
+#endif
 
 // uart.c
 extern DMA_HandleTypeDef hdma_usart1_l_rx;
@@ -32,6 +39,12 @@ extern UART_HandleTypeDef huart1_l;
 extern UART_HandleTypeDef huart2_u_r;
 extern UART_HandleTypeDef huart3_d;
 
+// timebase.c
+extern TIM_HandleTypeDef htim2_timebase;
+
+// sensor_poll.c
+extern TIM_HandleTypeDef htim6_sensor_poll;
+
 // All names of interrupts are defined in the startup file.
 
 // Cortex-M4 Core interrupt / exception handlers -------------------------------
@@ -58,16 +71,28 @@ void UsageFault_Handler(void) {
     error_panic(Error_Cortex_UsageFault);
  }
 
+// The kernel provides SVC and PendSV in the RTOS build
+#ifndef USE_CMSIS_RTOS
 // System service call via SWI instruction handler
 void SVC_Handler(void) { }
+#endif
 
 // Debug monitor handler
 void DebugMon_Handler(void) {  }
 
+#ifndef USE_CMSIS_RTOS
 // Pendable request for system service handler
 void PendSV_Handler(void) { }
+#endif
 
-void SysTick_Handler(void) { HAL_IncTick(); }
+void SysTick_Handler(void) {
+    HAL_IncTick();
+    events_post(EVENT_TICK);
+
+#ifdef USE_CMSIS_RTOS
+    osSystickHandler();
+#endif
+}
 
 // STM32F3xx Peripheral Interrupt Handlers -------------------------------------
 
@@ -114,4 +139,19 @@ void USART2_IRQHandler() {
 // Down
 void USART3_IRQHandler() {
     HAL_UART_IRQHandler(&huart3_d);
-}
\ No newline at end of file
+}
+
+// Timebase alarm
+void TIM2_IRQHandler(void) {
+    HAL_TIM_IRQHandler(&htim2_timebase);
+}
+
+// Sensor poll timer
+void TIM6_DAC_IRQHandler(void) {
+    HAL_TIM_IRQHandler(&htim6_sensor_poll);
+}
+
+// End of a config page erase (eeprom_emul.c)
+void FLASH_IRQHandler(void) {
+    HAL_FLASH_IRQHandler();
+}
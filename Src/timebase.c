@@ -0,0 +1,60 @@
+#include "timebase.h"
+#include "stm32f3xx_hal.h"
+#include "error_handler.h"
+
+#define TIMEBASE_TICK_HZ (1000000U)
+
+TIM_HandleTypeDef htim2_timebase;
+
+static volatile AlarmHandler alarm_handler = NULL;
+
+void timebase_init() {
+    // Cycle counter; needs trace enabled in the debug block to run
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // APB1 is divided down, so the timer kernel clock is twice PCLK1
+    uint32_t timer_clock = HAL_RCC_GetPCLK1Freq() * 2;
+
+    htim2_timebase.Instance = TIM2;
+    htim2_timebase.Init.Prescaler = (timer_clock / TIMEBASE_TICK_HZ) - 1;
+    htim2_timebase.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim2_timebase.Init.Period = 0xFFFFFFFF;
+    htim2_timebase.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    htim2_timebase.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+
+    if (HAL_TIM_Base_Init(&htim2_timebase) != HAL_OK) {
+        error_panic(Error_HAL_TIM_Init);
+    }
+
+    if (HAL_TIM_Base_Start(&htim2_timebase) != HAL_OK) {
+        error_panic(Error_HAL_TIM_Start);
+    }
+}
+
+void timebase_set_alarm(uint32_t at, AlarmHandler handler) {
+    __HAL_TIM_DISABLE_IT(&htim2_timebase, TIM_IT_CC1);
+
+    alarm_handler = handler;
+    __HAL_TIM_SET_COMPARE(&htim2_timebase, TIM_CHANNEL_1, at);
+    __HAL_TIM_CLEAR_FLAG(&htim2_timebase, TIM_FLAG_CC1);
+    __HAL_TIM_ENABLE_IT(&htim2_timebase, TIM_IT_CC1);
+
+    // A time already passed only matches again once the counter wraps
+    if ((int32_t)(at - timebase_us()) <= 0) {
+        __HAL_TIM_DISABLE_IT(&htim2_timebase, TIM_IT_CC1);
+        handler();
+    }
+}
+
+// Invoked by the HAL from the TIM2 interrupt on a compare match
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef * htim) {
+    if (htim != &htim2_timebase) return;
+
+    __HAL_TIM_DISABLE_IT(htim, TIM_IT_CC1);
+
+    if (alarm_handler != NULL) {
+        alarm_handler();
+    }
+}
@@ -51,12 +51,33 @@ typedef struct
   CFG_TUSB_MEM_ALIGN uint8_t epin_buf[CFG_TUD_HID_BUFSIZE];
   CFG_TUSB_MEM_ALIGN uint8_t epout_buf[CFG_TUD_HID_BUFSIZE];
 
+  // Buffer the OUT endpoint is currently armed on, NULL while paused
+  uint8_t* epout_rx_buf;
+
   tusb_hid_descriptor_hid_t const * hid_descriptor;
 } hidd_interface_t;
 
 CFG_TUSB_MEM_SECTION static hidd_interface_t _hidd_itf[CFG_TUD_HID];
 
 /*------------- Helpers -------------*/
+// Arm the OUT endpoint on a buffer supplied by the application if it wants
+// to receive in place, or on the class buffer otherwise. The endpoint is
+// left paused (NAKing) if the application has no buffer to offer.
+static bool arm_out_endpoint(uint8_t rhport, hidd_interface_t* p_hid)
+{
+  uint8_t* buffer = p_hid->epout_buf;
+  uint16_t len = sizeof(p_hid->epout_buf);
+
+  if (tud_hid_receive_buffer_cb)
+  {
+    buffer = tud_hid_receive_buffer_cb((uint8_t) (p_hid - _hidd_itf), &len);
+    if (buffer == NULL) return true;
+  }
+
+  p_hid->epout_rx_buf = buffer;
+  return usbd_edpt_xfer(rhport, p_hid->ep_out, buffer, len);
+}
+
 static inline hidd_interface_t* get_interface_by_itfnum(uint8_t itf_num)
 {
   for (uint8_t i=0; i < CFG_TUD_HID; i++ )
@@ -70,19 +91,18 @@ static inline hidd_interface_t* get_interface_by_itfnum(uint8_t itf_num)
 //--------------------------------------------------------------------+
 // APPLICATION API
 //--------------------------------------------------------------------+
-bool tud_hid_ready(void)
+bool tud_hid_n_ready(uint8_t instance)
 {
-  uint8_t itf = 0;
-  uint8_t const ep_in = _hidd_itf[itf].ep_in;
+  TU_VERIFY(instance < CFG_TUD_HID);
+  uint8_t const ep_in = _hidd_itf[instance].ep_in;
   return tud_ready() && (ep_in != 0) && usbd_edpt_ready(TUD_OPT_RHPORT, ep_in);
 }
 
-bool tud_hid_report(uint8_t report_id, void const* report, uint8_t len)
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const* report, uint8_t len)
 {
-  TU_VERIFY( tud_hid_ready() );
+  TU_VERIFY( tud_hid_n_ready(instance) );
 
-  uint8_t itf = 0;
-  hidd_interface_t * p_hid = &_hidd_itf[itf];
+  hidd_interface_t * p_hid = &_hidd_itf[instance];
 
   if (report_id)
   {
@@ -101,10 +121,21 @@ bool tud_hid_report(uint8_t report_id, void const* report, uint8_t len)
   return usbd_edpt_xfer(TUD_OPT_RHPORT, p_hid->ep_in, p_hid->epin_buf, len);
 }
 
-bool tud_hid_boot_mode(void)
+bool tud_hid_n_receive_resume(uint8_t instance)
 {
-  uint8_t itf = 0;
-  return _hidd_itf[itf].boot_mode;
+  TU_VERIFY(instance < CFG_TUD_HID);
+  hidd_interface_t * p_hid = &_hidd_itf[instance];
+
+  // Nothing to do unless the endpoint exists and is paused
+  if ( !tud_ready() || p_hid->ep_out == 0 || p_hid->epout_rx_buf != NULL ) return true;
+
+  return arm_out_endpoint(TUD_OPT_RHPORT, p_hid);
+}
+
+bool tud_hid_n_boot_mode(uint8_t instance)
+{
+  TU_VERIFY(instance < CFG_TUD_HID);
+  return _hidd_itf[instance].boot_mode;
 }
 
 //--------------------------------------------------------------------+
@@ -193,7 +224,7 @@ bool hidd_open(uint8_t rhport, tusb_desc_interface_t const * desc_itf, uint16_t
   *p_len = sizeof(tusb_desc_interface_t) + sizeof(tusb_hid_descriptor_hid_t) + desc_itf->bNumEndpoints*sizeof(tusb_desc_endpoint_t);
 
   // Prepare for output endpoint
-  if (p_hid->ep_out) TU_ASSERT(usbd_edpt_xfer(rhport, p_hid->ep_out, p_hid->epout_buf, sizeof(p_hid->epout_buf)));
+  if (p_hid->ep_out) TU_ASSERT(arm_out_endpoint(rhport, p_hid));
 
   return true;
 }
@@ -221,7 +252,7 @@ bool hidd_control_request(uint8_t rhport, tusb_control_request_t const * request
     }
     else if (request->bRequest == TUSB_REQ_GET_DESCRIPTOR && desc_type == HID_DESC_TYPE_REPORT)
     {
-      uint8_t const * desc_report = tud_hid_descriptor_report_cb();
+      uint8_t const * desc_report = tud_hid_descriptor_report_cb((uint8_t) (p_hid - _hidd_itf));
       tud_control_xfer(rhport, request, (void*) desc_report, p_hid->report_desc_len);
     }
     else
@@ -330,8 +361,11 @@ bool hidd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_
 
   if (ep_addr == p_hid->ep_out)
   {
-    tud_hid_set_report_cb(0, HID_REPORT_TYPE_INVALID, p_hid->epout_buf, xferred_bytes);
-    TU_ASSERT(usbd_edpt_xfer(rhport, p_hid->ep_out, p_hid->epout_buf, sizeof(p_hid->epout_buf)));
+    uint8_t* buffer = p_hid->epout_rx_buf;
+    p_hid->epout_rx_buf = NULL;
+
+    tud_hid_set_report_cb(0, HID_REPORT_TYPE_INVALID, buffer, xferred_bytes);
+    TU_ASSERT(arm_out_endpoint(rhport, p_hid));
   }
 
   return true;
@@ -48,13 +48,33 @@
 //--------------------------------------------------------------------+
 
 // Check if the interface is ready to use
-bool tud_hid_ready(void);
+bool tud_hid_n_ready(uint8_t instance);
 
 // Check if current mode is Boot (true) or Report (false)
-bool tud_hid_boot_mode(void);
+bool tud_hid_n_boot_mode(uint8_t instance);
 
 // Send report to host
-bool tud_hid_report(uint8_t report_id, void const* report, uint8_t len);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const* report, uint8_t len);
+
+// Arm the OUT endpoint again after tud_hid_receive_buffer_cb had no buffer
+// to offer. Does nothing if the endpoint is not paused.
+bool tud_hid_n_receive_resume(uint8_t instance);
+
+// Single interface helpers, operating on the first HID interface
+static inline bool tud_hid_ready(void)
+{
+  return tud_hid_n_ready(0);
+}
+
+static inline bool tud_hid_boot_mode(void)
+{
+  return tud_hid_n_boot_mode(0);
+}
+
+static inline bool tud_hid_report(uint8_t report_id, void const* report, uint8_t len)
+{
+  return tud_hid_n_report(0, report_id, report, len);
+}
 
 // KEYBOARD: convenient helper to send keyboard report if application
 // use template layout report as defined by hid_keyboard_report_t
@@ -70,7 +90,8 @@ bool tud_hid_mouse_report(uint8_t report_id, uint8_t buttons, int8_t x, int8_t y
 
 // Invoked when received GET HID REPORT DESCRIPTOR request
 // Application return pointer to descriptor, whose contents must exist long enough for transfer to complete
-uint8_t const * tud_hid_descriptor_report_cb(void);
+// instance is the index of the HID interface, in configuration descriptor order
+uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance);
 
 // Invoked when received GET_REPORT control request
 // Application must fill buffer report's content and return its length.
@@ -81,6 +102,13 @@ uint16_t tud_hid_get_report_cb(uint8_t report_id, hid_report_type_t report_type,
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize);
 
+// Invoked before arming the OUT endpoint, to receive the next report straight
+// into application memory. Return the buffer and set *len to its size, or
+// return NULL to pause the endpoint until tud_hid_n_receive_resume is called.
+// The buffer is handed back through tud_hid_set_report_cb.
+// If not implemented, reports are received into the class driver's buffer.
+TU_ATTR_WEAK uint8_t* tud_hid_receive_buffer_cb(uint8_t instance, uint16_t* len);
+
 // Invoked when received SET_PROTOCOL request ( mode switch Boot <-> Report )
 TU_ATTR_WEAK void tud_hid_boot_mode_cb(uint8_t boot_mode);
 
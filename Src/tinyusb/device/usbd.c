@@ -869,6 +869,12 @@ static bool process_get_descriptor(uint8_t rhport, tusb_control_request_t const
 //--------------------------------------------------------------------+
 // DCD Event Handler
 //--------------------------------------------------------------------+
+static inline void usbd_queue_event(dcd_event_t const * event, bool in_isr)
+{
+  osal_queue_send(_usbd_q, event, in_isr);
+  if (tud_event_queued_cb) tud_event_queued_cb();
+}
+
 void dcd_event_handler(dcd_event_t const * event, bool in_isr)
 {
   switch (event->event_id)
@@ -878,11 +884,20 @@ void dcd_event_handler(dcd_event_t const * event, bool in_isr)
       _usbd_dev.addressed  = 0;
       _usbd_dev.configured = 0;
       _usbd_dev.suspended  = 0;
-      osal_queue_send(_usbd_q, event, in_isr);
+      usbd_queue_event(event, in_isr);
     break;
 
     case DCD_EVENT_SOF:
-      return;   // skip SOF event for now
+      if (tud_sof_isr_cb) tud_sof_isr_cb();
+      return;   // skip SOF event for the task
+    break;
+
+    case DCD_EVENT_XFER_COMPLETE:
+      if (in_isr && tud_xfer_complete_isr_cb)
+      {
+        tud_xfer_complete_isr_cb(event->xfer_complete.ep_addr, event->xfer_complete.len);
+      }
+      usbd_queue_event(event, in_isr);
     break;
 
     case DCD_EVENT_SUSPEND:
@@ -892,7 +907,7 @@ void dcd_event_handler(dcd_event_t const * event, bool in_isr)
       if ( _usbd_dev.connected )
       {
         _usbd_dev.suspended = 1;
-        osal_queue_send(_usbd_q, event, in_isr);
+        usbd_queue_event(event, in_isr);
       }
     break;
 
@@ -901,12 +916,12 @@ void dcd_event_handler(dcd_event_t const * event, bool in_isr)
       if ( _usbd_dev.connected )
       {
         _usbd_dev.suspended = 0;
-        osal_queue_send(_usbd_q, event, in_isr);
+        usbd_queue_event(event, in_isr);
       }
     break;
 
     default:
-      osal_queue_send(_usbd_q, event, in_isr);
+      usbd_queue_event(event, in_isr);
     break;
   }
 }
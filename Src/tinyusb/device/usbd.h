@@ -106,6 +106,19 @@ TU_ATTR_WEAK void tud_suspend_cb(bool remote_wakeup_en);
 // Invoked when usb bus is resumed
 TU_ATTR_WEAK void tud_resume_cb(void);
 
+// Invoked on every Start-of-Frame, directly from the USB interrupt.
+// SOF is not queued for tud_task(), so this is the only way to observe it.
+TU_ATTR_WEAK void tud_sof_isr_cb(void);
+
+// Invoked whenever an event is queued for tud_task(), usually from the USB
+// interrupt, so the application knows tud_task() has work to do
+TU_ATTR_WEAK void tud_event_queued_cb(void);
+
+// Invoked when a transfer completes, directly from the USB interrupt and
+// before the event is queued for tud_task(). The class driver still handles
+// the transfer as usual afterwards.
+TU_ATTR_WEAK void tud_xfer_complete_isr_cb(uint8_t ep_addr, uint32_t xferred_bytes);
+
 // Invoked when received control request with VENDOR TYPE
 TU_ATTR_WEAK bool tud_vendor_control_request_cb(uint8_t rhport, tusb_control_request_t const * request);
 TU_ATTR_WEAK bool tud_vendor_control_complete_cb(uint8_t rhport, tusb_control_request_t const * request);
@@ -25,6 +25,7 @@
 
 #include "tusb.h"
 #include "debug_leds.h"
+#include "tusb_hid.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save
  * device driver after the first plug.
@@ -39,7 +40,9 @@
                  _PID_MAP(HID, 2) | _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4))
 
 #define USBD_VID 1155
-#define USBD_PID_FS 22352
+// 22352 was the data HID interface alone. The composite device (data HID,
+// gamepad HID, vendor bulk) gets its own.
+#define USBD_PID_FS 22353
 
 
 //--------------------------------------------------------------------+
@@ -56,7 +59,7 @@ tusb_desc_device_t const desc_device = {
 
     .idVendor           = USBD_VID,
     .idProduct          = USBD_PID_FS,
-    .bcdDevice          = 0x0200,
+    .bcdDevice          = 0x0210,
 
     .iManufacturer      = 0x01,
     .iProduct           = 0x02,
@@ -96,11 +99,33 @@ uint8_t const desc_hid_report[] = {
     0xC0,              // End Collection
 };
 
+// Gamepad, reporting one button per panel as chosen by the profile
+// Report layout: 16 bit button map, button 1 in the lowest bit
+uint8_t const desc_hid_gamepad_report[] = {
+    0x05, 0x01,        // Usage Page (Generic Desktop)
+    0x09, 0x05,        // Usage (Game Pad)
+    0xA1, 0x01,        // Collection (Application)
+    0x05, 0x09,        //   Usage Page (Button)
+    0x19, 0x01,        //   Usage Minimum (Button 1)
+    0x29, 0x10,        //   Usage Maximum (Button 16)
+    0x15, 0x00,        //   Logical Minimum (0)
+    0x25, 0x01,        //   Logical Maximum (1)
+    0x75, 0x01,        //   Report Size (1)
+    0x95, 0x10,        //   Report Count (16)
+    0x81, 0x02,        //   Input (Data,Var,Abs,No Wrap,Linear,Preferred State,
+                       //   No Null Position)
+    0xC0,              // End Collection
+};
+
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
-uint8_t const * tud_hid_descriptor_report_cb(void) {
-  return desc_hid_report;
+uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance) {
+    if (instance == USB_HID_INSTANCE_GAMEPAD) {
+        return desc_hid_gamepad_report;
+    }
+
+    return desc_hid_report;
 }
 
 //--------------------------------------------------------------------+
@@ -113,9 +138,9 @@ uint8_t const desc_configuration[] = {
     // https://www.keil.com/pack/doc/mw/USB/html/_u_s_b__configuration__descriptor.html
     TUD_CONFIG_DESC_LEN, // bLength: Config Descriptor size: 9 bytes
     TUSB_DESC_CONFIGURATION, // bDescriptorType: configuration
-    41, // wTotalLength: (low byte) Total size of full descriptor: 41 bytes
+    82, // wTotalLength: (low byte) Total size of full descriptor: 82 bytes
     0, // wTotalLength (high byte)
-    1, // bNumInterfaces
+    3, // bNumInterfaces
     1, // bConfigurationValue: Selected configuration id
     0, // iConfiguration: index of string descriptor describing this config
     0xC0, // bmAttributes: 1100 0000 - Self-powered, no remote wakeup
@@ -186,6 +211,69 @@ uint8_t const desc_configuration[] = {
     64,   // wMaxPacketSize: (lobyte) 64 bytes
     0,    // wMaxPacketSize: (hibyte)
     1,    // bInterval: Polling interval expressed in ms
+
+    // Interface descriptor, HID gamepad --------------------------------------
+    9, // bLength: Interface descriptor size
+    TUSB_DESC_INTERFACE, // bDescriptorType
+    1, // bInterfaceNumber: 0-based index
+    0, // bAlternateSetting: 0 for not changing settings on the fly
+    1, // bNumEndpoints: Number of endpoints in interface: 1:
+       // 1. Button states: device->host
+    0x03, // bInterfaceClass: Human-Interface-Device (HID)
+    0x00, // bInterfaceSubClass: No boot
+    0x00, // bInterfaceProtocol: None
+    0,    // iInterface: index of string descriptor for this interface
+
+    // Gamepad HID Descriptor --------------------------------------------------
+    9, // bLength: HID descriptor size
+    TUSB_DESC_CS_DEVICE, // bDescriptorType: HID
+    0x11, // bcdHID: Version of the HID specification, binary coded decimal
+    0x01, // bcdHID: high byte (version 1.11)
+    0x00, // bCountryCode: None / not supported
+    0x01, // bNumDescriptors: number of class descriptors to follow
+    TUSB_DESC_CS_CONFIGURATION, // bDescriptionType: class specific config
+    sizeof(desc_hid_gamepad_report), // wDescriptorLength for report desc.
+    0x00, // wDescriptorLength
+
+    // Endpoint Descriptor -----------------------------------------------------
+    7, // bLength: endpoint descriptor size
+    TUSB_DESC_ENDPOINT, // bDescriptorType
+    0x82, // 1000 0010 bEndpointAddress
+          // |||| \\\\- Endpoint number
+          // |\\\- Reserved, forced 0
+          // \- Direction: 1 = IN endpoint (device->host)
+    0x03, // 0000 0011 bmAttributes
+          // |||| ||\\- Transfer type: Interrupt
+          // \\\\ \\- Reserved, forced 0
+    8,    // wMaxPacketSize: (lobyte) 8 bytes
+    0,    // wMaxPacketSize: (hibyte)
+    1,    // bInterval: Polling interval expressed in ms
+
+    // Interface descriptor, vendor bulk ---------------------------------------
+    9, // bLength: Interface descriptor size
+    TUSB_DESC_INTERFACE, // bDescriptorType
+    2, // bInterfaceNumber: 0-based index
+    0, // bAlternateSetting: 0 for not changing settings on the fly
+    1, // bNumEndpoints: Number of endpoints in interface: 1:
+       // 1. Whole LED frames: host->device
+    0xFF, // bInterfaceClass: Vendor specific
+    0x00, // bInterfaceSubClass
+    0x00, // bInterfaceProtocol
+    0,    // iInterface: index of string descriptor for this interface
+
+    // Endpoint Descriptor -----------------------------------------------------
+    7, // bLength: endpoint descriptor size
+    TUSB_DESC_ENDPOINT, // bDescriptorType
+    0x03, // 0000 0011 bEndpointAddress
+          // |||| \\\\- Endpoint number
+          // |\\\- Reserved, forced 0
+          // \- Direction: 0 = OUT endpoint (host->device)
+    0x02, // 0000 0010 bmAttributes
+          // |||| ||\\- Transfer type: Bulk
+          // \\\\ \\- Reserved, forced 0
+    64,   // wMaxPacketSize: (lobyte) 64 bytes
+    0,    // wMaxPacketSize: (hibyte)
+    0,    // bInterval: Ignored for bulk endpoints
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
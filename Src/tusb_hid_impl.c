@@ -1,10 +1,40 @@
 #include "hid_device.h"
 #include "tusb_hid.h"
+#include "led_frame.h"
+#include "config.h"
+#include "sensor_report.h"
+#include "hid_protocol.h"
 
 #define PACKET_SIZE (64U)
+#define PACKET_QUEUE_DEPTH (8U)
 
-static uint8_t usb_buffer[PACKET_SIZE];
-static bool have_packet = false;
+// Packets received from the host, oldest at packet_front. The OUT endpoint
+// receives straight into the slot after the last queued packet, and pauses
+// while the queue is full, so the host is held off instead of packets being
+// lost. Both ends run in tud_task / main loop context, so no locking is
+// needed.
+static uint8_t packet_queue[PACKET_QUEUE_DEPTH][PACKET_SIZE];
+static uint8_t packet_front = 0;
+static uint8_t packet_count = 0;
+
+// A report that came in through the control pipe instead. The OUT endpoint
+// may be receiving into the rear slot at any time, so it's kept aside and
+// handed out after the packets that were queued before it arrived.
+static uint8_t control_packet[PACKET_SIZE];
+static uint8_t control_pending = 0;
+static uint8_t control_after = 0;
+
+// Slot the OUT endpoint was last armed on, and whether the USB interrupt fast
+// path already handled the packet received into it
+static uint8_t * armed_slot = NULL;
+static volatile uint8_t armed_slot_handled = 0;
+
+// Public, so that contents can be inspected during debugging
+uint32_t usb_packets_received = 0;
+uint32_t usb_packets_dropped = 0;
+uint32_t usb_receive_pauses = 0;
+uint32_t usb_packets_fast_path = 0;
+uint8_t usb_packet_queue_high_water = 0;
 
 uint8_t const report_descriptor[] = {
     0x06, 0x00, 0xFF,  // Usage Page (Vendor Defined 0xFF00)
@@ -48,6 +78,48 @@ uint16_t tud_hid_get_report_cb(
 }
 
 
+static inline uint8_t * queue_rear() {
+    return packet_queue[(packet_front + packet_count) % PACKET_QUEUE_DEPTH];
+}
+
+// Invoked before arming the OUT endpoint, supplies the queue slot to
+// receive the next packet into
+uint8_t * tud_hid_receive_buffer_cb(uint8_t instance, uint16_t * len) {
+    if (packet_count == PACKET_QUEUE_DEPTH) {
+        usb_receive_pauses++;
+        armed_slot = NULL;
+        return NULL;
+    }
+
+    *len = PACKET_SIZE;
+    armed_slot = queue_rear();
+    return armed_slot;
+}
+
+// Invoked from the USB interrupt when a transfer completes. Reports going
+// out are timed for sensor_report. With the fast path enabled, an LED
+// segment on the data OUT endpoint is handed to led_frame right away through
+// hid_protocol, provided no older packet is still queued, so packets are
+// still handled in order.
+void tud_xfer_complete_isr_cb(uint8_t ep_addr, uint32_t xferred_bytes) {
+    if (ep_addr == USB_HID_DATA_EP_IN) {
+        sensor_report_on_sent();
+        return;
+    }
+
+#if LED_ISR_FAST_PATH
+    if (ep_addr != USB_HID_DATA_EP_OUT
+        || armed_slot == NULL
+        || packet_count > 0
+        || control_pending
+        || xferred_bytes != PACKET_SIZE) {
+        return;
+    }
+
+    armed_slot_handled = hid_protocol_dispatch_isr(armed_slot);
+#endif
+}
+
 // Invoked when received SET_REPORT control request or
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(
@@ -57,16 +129,74 @@ void tud_hid_set_report_cb(
     uint16_t bufsize
 ) {
     if (report_id == 0 && report_type == 0) {
-        for (uint16_t i = 0; i < bufsize; i++) {
-            usb_buffer[i] = buffer[i];
+        usb_packets_received++;
+
+        // Already dealt with in the interrupt, the slot can be reused
+        if (armed_slot_handled && buffer == armed_slot) {
+            armed_slot_handled = 0;
+            usb_packets_fast_path++;
+            return;
+        }
+
+        // Packets from the OUT endpoint are received in place, anything
+        // received elsewhere is copied aside. Either way the packets already
+        // waiting are kept, they were sent first.
+        if (buffer != armed_slot) {
+            if (control_pending) {
+                usb_packets_dropped++;
+                return;
+            }
+
+            if (bufsize > PACKET_SIZE) bufsize = PACKET_SIZE;
+
+            for (uint16_t i = 0; i < bufsize; i++) {
+                control_packet[i] = buffer[i];
+            }
+
+            control_after = packet_count;
+            control_pending = 1;
+            return;
         }
 
-        have_packet = true;
+        if (packet_count == PACKET_QUEUE_DEPTH) {
+            usb_packets_dropped++;
+            return;
+        }
+
+        packet_count++;
+        if (packet_count > usb_packet_queue_high_water) {
+            usb_packet_queue_high_water = packet_count;
+        }
     }
 }
 
+// Invoked when the device is unmounted, the next host starts out with
+// legacy framing
+void tud_umount_cb(void) {
+    hid_protocol_reset();
+}
+
 uint8_t * usb_get_packet() {
-    if (!have_packet) return NULL;
+    if (control_pending && control_after == 0) return control_packet;
+    if (packet_count == 0) return NULL;
+
+    return packet_queue[packet_front];
+}
+
+void usb_consume_packet() {
+    if (control_pending && control_after == 0) {
+        control_pending = 0;
+        return;
+    }
+
+    if (packet_count == 0) return;
+
+    packet_front = (packet_front + 1) % PACKET_QUEUE_DEPTH;
+    packet_count--;
+
+    if (control_pending) {
+        control_after--;
+    }
 
-    return usb_buffer;
+    tud_hid_n_receive_resume(USB_HID_INSTANCE_DATA);
 }
\ No newline at end of file
@@ -59,6 +59,12 @@ ComportId switched_comport = Comport_None;
 
 static SendCompleteHandler send_complete_handler = NULL;
 static ReceiveCompleteHandler receive_complete_handler = NULL;
+static PortErrorHandler error_handler = NULL;
+
+// Errors reported by the HAL and ports reset after a fault, per port
+// Public, so that contents can be inspected during debugging
+uint32_t uart_errors[COMPORT_ID_MAX + 1];
+uint32_t uart_port_resets[COMPORT_ID_MAX + 1];
 
 static void init_gpio();
 static void init_rs485();
@@ -132,28 +138,36 @@ void uart_init() {
     DBG_LED3_OFF();
 }
 
-void uart_send(ComportId comport_id, uint8_t * data_ptr, uint16_t data_len) {
-    UART_HandleTypeDef * huart = get_uart_handle(comport_id);
-    HAL_StatusTypeDef result = transmit_dma(huart, data_ptr, data_len);
-    
-    if (result != HAL_OK) {
-        error_panic_data(Error_HAL_UART_Transmit_DMA, (uint32_t)result);
-    }
+HAL_StatusTypeDef uart_send(
+    ComportId comport_id, uint8_t * data_ptr, uint16_t data_len) {
+    return transmit_dma(get_uart_handle(comport_id), data_ptr, data_len);
 }
 
-void uart_receive(ComportId comport_id, uint8_t * data_ptr, uint16_t data_len) {
-    UART_HandleTypeDef * huart = get_uart_handle(comport_id);
-    HAL_StatusTypeDef result = receive_dma(huart, data_ptr, data_len);
-    
-    if (result != HAL_OK) {
-        error_panic_data(Error_HAL_UART_Receive_DMA, result);
-    }
+HAL_StatusTypeDef uart_receive(
+    ComportId comport_id, uint8_t * data_ptr, uint16_t data_len) {
+    return receive_dma(get_uart_handle(comport_id), data_ptr, data_len);
 }
 
 void uart_abort_receive(ComportId comport_id) {
     HAL_UART_AbortReceive(get_uart_handle(comport_id));
 }
 
+void uart_reset_port(ComportId comport_id) {
+    if ((comport_id == Comport_Up || comport_id == Comport_Right)
+        && comport_id != switched_comport) {
+        return;
+    }
+
+    UART_HandleTypeDef * huart = get_uart_handle(comport_id);
+
+    HAL_UART_Abort(huart);
+    __HAL_UART_CLEAR_FLAG(huart,
+        UART_CLEAR_PEF | UART_CLEAR_FEF | UART_CLEAR_NEF | UART_CLEAR_OREF);
+    __HAL_UART_SEND_REQ(huart, UART_RXDATA_FLUSH_REQUEST);
+
+    uart_port_resets[comport_id]++;
+}
+
 void uart_set_on_send_complete_handler(SendCompleteHandler handler) {
     send_complete_handler = handler;
 }
@@ -162,6 +176,20 @@ void uart_set_on_receive_complete_handler(ReceiveCompleteHandler handler) {
     receive_complete_handler = handler;
 }
 
+void uart_set_on_error_handler(PortErrorHandler handler) {
+    error_handler = handler;
+}
+
+uint8_t uart_panel_initialized(ComportId comport_id) {
+    switch (comport_id) {
+        case Comport_Left: return PANEL_LEFT_INITIALIZED == GPIO_PIN_SET;
+        case Comport_Down: return PANEL_DOWN_INITIALIZED == GPIO_PIN_SET;
+        case Comport_Up: return PANEL_UP_INITIALIZED == GPIO_PIN_SET;
+        case Comport_Right: return PANEL_RIGHT_INITIALIZED == GPIO_PIN_SET;
+        default: return false;
+    }
+}
+
 void uart_connect_port(ComportId comport_id) {
     // Only right/up need any special work, so others are no-op.
     if (comport_id != Comport_Right && comport_id != Comport_Up) return;
@@ -356,28 +384,36 @@ static void init_dma_interrupts() {
     HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
 }
 
+// Port a UART handle is currently serving
+static inline ComportId get_comport(UART_HandleTypeDef *huart) {
+    if (huart == &huart1_l) return Comport_Left;
+    if (huart == &huart2_u_r) return switched_comport;
+    return Comport_Down;
+}
+
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
     if (send_complete_handler == NULL) return;
     HAL_UART_AbortTransmit(huart);
 
-    if (huart == &huart1_l) {
-        send_complete_handler(Comport_Left);
-    } else if (huart == &huart2_u_r) {
-        send_complete_handler(switched_comport);
-    } else {
-        send_complete_handler(Comport_Down);
-    }
+    send_complete_handler(get_comport(huart));
 }
 
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
     if (receive_complete_handler == NULL) return;
     HAL_UART_AbortReceive(huart);
 
-    if (huart == &huart1_l) {
-        receive_complete_handler(Comport_Left);
-    } else if (huart == &huart2_u_r) {
-        receive_complete_handler(switched_comport);
-    } else {
-        receive_complete_handler(Comport_Down);
+    receive_complete_handler(get_comport(huart));
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    ComportId comport_id = get_comport(huart);
+
+    // USART2 before either of its ports has been connected
+    if (comport_id == Comport_None) return;
+
+    uart_errors[comport_id]++;
+
+    if (error_handler != NULL) {
+        error_handler(comport_id, huart->ErrorCode);
     }
 }
\ No newline at end of file
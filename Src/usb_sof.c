@@ -0,0 +1,30 @@
+#include "usb_sof.h"
+#include "tusb.h"
+#include "timebase.h"
+#include "led_frame.h"
+#include "events.h"
+#include "sensor_report.h"
+
+// Public, so that contents can be inspected during debugging
+volatile uint16_t sof_frame = 0;
+volatile uint32_t sof_timestamp = 0;
+volatile uint32_t sof_count = 0;
+
+uint16_t usb_sof_frame() {
+    return sof_frame;
+}
+
+uint32_t usb_sof_timestamp() {
+    return sof_timestamp;
+}
+
+// Invoked from the USB interrupt on every SOF
+void tud_sof_isr_cb(void) {
+    sof_timestamp = timebase_us();
+    sof_frame = USB->FNR & USB_FNR_FN;
+    sof_count++;
+
+    led_frame_on_sof();
+    sensor_report_on_sof();
+    events_post(EVENT_SOF);
+}
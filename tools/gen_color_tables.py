@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Generates the colour lookup tables used by Src/color.c.
+
+Run by the Makefile at build time, writing C source to stdout:
+
+  color_gamma_table  gamma correction, 8 bit in and out
+  color_hue_table    fully saturated colour at full brightness for each
+                     1/256th of the hue circle, plus the first entry again
+                     at the end so neighbours can be interpolated without
+                     wrapping
+"""
+
+import argparse
+import colorsys
+import sys
+
+HUE_STEPS = 256
+
+
+def gamma_table(gamma):
+    return [round(255 * (i / 255) ** gamma) for i in range(256)]
+
+
+def hue_table():
+    table = []
+    for i in range(HUE_STEPS + 1):
+        r, g, b = colorsys.hsv_to_rgb((i % HUE_STEPS) / HUE_STEPS, 1.0, 1.0)
+        table.append(tuple(round(c * 255) for c in (r, g, b)))
+    return table
+
+
+def rows(values, per_row):
+    for i in range(0, len(values), per_row):
+        yield "    " + " ".join(values[i:i + per_row])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--gamma", type=float, default=2.6,
+                        help="gamma of the LEDs' brightness response")
+    args = parser.parse_args()
+
+    out = sys.stdout
+    out.write("// Generated by tools/gen_color_tables.py, do not edit\n\n")
+    out.write('#include "color.h"\n\n')
+
+    out.write(f"// Gamma {args.gamma}\n")
+    out.write("const uint8_t color_gamma_table[256] = {\n")
+    out.write("\n".join(rows([f"{v:3d}," for v in gamma_table(args.gamma)], 16)))
+    out.write("\n};\n\n")
+
+    out.write(f"const Color_RGB color_hue_table[{HUE_STEPS + 1}] = {{\n")
+    out.write("\n".join(rows(
+        ["{%3d, %3d, %3d}," % c for c in hue_table()], 4)))
+    out.write("\n};\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
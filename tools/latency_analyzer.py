@@ -0,0 +1,312 @@
+#!/usr/bin/env python3
+"""Input latency analyzer for the RE:Flex Dance I/O board.
+
+Reads sensor reports from the board's HID interface and uses the timing
+fields the firmware adds to each report (see Inc/sensor_report.h) to produce
+latency distributions:
+
+- sample age:  time between a panel's sensor data arriving at the I/O board
+               and the report carrying it being queued for USB (device clock)
+- frame phase: where in the 1ms USB frame the report was queued, relative to
+               the preceding SOF (device clock)
+- delivery:    time between the report being queued and the host receiving
+               it. The device and host clocks are not synchronised, so this is
+               measured relative to the fastest delivery seen in the capture,
+               after removing clock drift. It is a lower bound.
+- end to end:  sample age + delivery, the time from the panel's data arriving
+               at the I/O board to the host application seeing it.
+
+The device clock is also checked against the USB frame counter, which runs
+from the host's clock, to report the drift between the two.
+
+The capture runs in a typed HID session (see Inc/hid_protocol.h), where
+sensor reports can be told apart from replies by their type byte. The board
+is put back into legacy framing afterwards.
+
+Requires the 'hid' package (pip install hid), which wraps hidapi.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+VENDOR_ID = 1155
+PRODUCT_ID = 22353
+REPORT_SIZE = 64
+
+# The data interface, as opposed to the gamepad one next to it
+DATA_INTERFACE = 0
+DATA_USAGE_PAGE = 0xFF00
+
+PANEL_NAMES = ("left", "down", "up", "right")
+AGE_UNKNOWN = 0xFFFF
+
+# <sequence, timestamp, sof frame, sof offset, 4x panel age>, after the
+# type byte of a typed session
+REPORT_TIMING = struct.Struct("<IIHH4H")
+REPORT_TIMING_OFFSET = 1 + 32
+
+PACKET_VERSION = 0x80
+PACKET_SENSOR_REPORT = 0x86
+PACKET_LEGACY = 0x87
+
+# SHA-512 of "REFLEXPROTOCOL", starts a typed session
+VERSION_QUERY = bytes.fromhex(
+    "fe5b3a9ca4e32a0625c539912043699d2e265d39f15ecbc4561d2dd0b0262670"
+    "fdf4d99cb96cadcc0b792bfb46ef99ba776e067acb2d7832dd21c48ebbb6a84b")
+
+DRIFT_WINDOW_US = 1000000
+
+
+class Report:
+    __slots__ = ("host_us", "sequence", "device_us", "frame", "sof_offset",
+                 "ages")
+
+    def __init__(self, host_us, data):
+        fields = REPORT_TIMING.unpack_from(bytes(data), REPORT_TIMING_OFFSET)
+        self.host_us = host_us
+        self.sequence = fields[0]
+        self.device_us = fields[1]
+        self.frame = fields[2]
+        self.sof_offset = fields[3]
+        self.ages = fields[4:]
+
+
+def unwrap(values, modulus):
+    """Turns a wrapping counter into a monotonically increasing one."""
+    result = []
+    offset = 0
+    previous = None
+
+    for value in values:
+        if previous is not None and value < previous:
+            offset += modulus
+        result.append(value + offset)
+        previous = value
+
+    return result
+
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return float("nan")
+    index = min(len(sorted_values) - 1, int(fraction * len(sorted_values)))
+    return sorted_values[index]
+
+
+def fit_line(points):
+    """Least squares fit, returns (slope, intercept)."""
+    n = len(points)
+    if n < 2:
+        return 0.0, points[0][1] if points else 0.0
+
+    sum_x = sum(p[0] for p in points)
+    sum_y = sum(p[1] for p in points)
+    sum_xx = sum(p[0] * p[0] for p in points)
+    sum_xy = sum(p[0] * p[1] for p in points)
+    denominator = n * sum_xx - sum_x * sum_x
+
+    if denominator == 0:
+        return 0.0, sum_y / n
+
+    slope = (n * sum_xy - sum_x * sum_y) / denominator
+    return slope, (sum_y - slope * sum_x) / n
+
+
+def delivery_times(reports, device_times):
+    """Host receive time minus device queue time, with drift removed and the
+    fastest delivery taken as zero."""
+    differences = [r.host_us - d for r, d in zip(reports, device_times)]
+
+    # The minimum of each window is the delivery least affected by host
+    # scheduling, so fit the clock drift through those.
+    minima = {}
+    for device_us, difference in zip(device_times, differences):
+        window = device_us // DRIFT_WINDOW_US
+        if window not in minima or difference < minima[window][1]:
+            minima[window] = (device_us, difference)
+
+    slope, intercept = fit_line(list(minima.values()))
+    corrected = [
+        diff - (slope * dev + intercept)
+        for dev, diff in zip(device_times, differences)
+    ]
+
+    floor = min(corrected)
+    return [c - floor for c in corrected], slope
+
+
+def summarize(name, values, unit="us"):
+    values = sorted(values)
+    if not values:
+        print(f"{name:<22} no samples")
+        return
+
+    print(
+        f"{name:<22} n={len(values):<7} "
+        f"min={values[0]:8.1f} "
+        f"p50={percentile(values, 0.50):8.1f} "
+        f"p90={percentile(values, 0.90):8.1f} "
+        f"p99={percentile(values, 0.99):8.1f} "
+        f"p99.9={percentile(values, 0.999):8.1f} "
+        f"max={values[-1]:8.1f} {unit}"
+    )
+
+
+def histogram(name, values, bucket_us, width=50):
+    if not values:
+        return
+
+    buckets = {}
+    for value in values:
+        bucket = int(value // bucket_us)
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+
+    peak = max(buckets.values())
+    print(f"\n{name} ({bucket_us}us buckets)")
+
+    for bucket in range(min(buckets), max(buckets) + 1):
+        count = buckets.get(bucket, 0)
+        bar = "#" * max(1 if count else 0, count * width // peak)
+        low = bucket * bucket_us
+        print(f"  {low:7.0f} - {low + bucket_us:7.0f} {count:7} {bar}")
+
+
+def write_packet(device, packet):
+    # No report IDs, hidapi wants a zero in their place
+    data = bytes(packet).ljust(REPORT_SIZE, b"\x00")
+    device.write(b"\x00" + data)
+
+
+def start_typed_session(device, timeout_ms):
+    write_packet(device, VERSION_QUERY)
+
+    deadline = time.monotonic() + timeout_ms / 1000.0
+    while time.monotonic() < deadline:
+        data = device.read(REPORT_SIZE, timeout_ms)
+        if data and data[0] == PACKET_VERSION:
+            if data[2] < 1:
+                raise RuntimeError("Firmware does not support typed sessions")
+            return
+
+    raise TimeoutError("No version reply from the I/O board")
+
+
+def open_device():
+    import hid
+
+    # Not every platform reports interface numbers, the usage page tells the
+    # data interface apart as well
+    for info in hid.enumerate(VENDOR_ID, PRODUCT_ID):
+        if (info["interface_number"] == DATA_INTERFACE
+                or info["usage_page"] == DATA_USAGE_PAGE):
+            device = hid.device()
+            device.open_path(info["path"])
+            return device
+
+    raise RuntimeError("I/O board not found")
+
+
+def capture(count, timeout_ms):
+    device = open_device()
+    reports = []
+
+    try:
+        start_typed_session(device, timeout_ms)
+
+        while len(reports) < count:
+            data = device.read(REPORT_SIZE, timeout_ms)
+            host_us = time.perf_counter_ns() // 1000
+
+            if not data:
+                raise TimeoutError("No report received from the I/O board")
+            if len(data) < REPORT_SIZE or data[0] != PACKET_SENSOR_REPORT:
+                continue
+
+            reports.append(Report(host_us, data))
+    finally:
+        write_packet(device, [PACKET_LEGACY])
+        device.close()
+
+    return reports
+
+
+def analyze(reports, bucket_us, per_panel):
+    sequences = unwrap([r.sequence for r in reports], 1 << 32)
+    device_times = unwrap([r.device_us for r in reports], 1 << 32)
+    frames = unwrap([r.frame for r in reports], 1 << 11)
+
+    gaps = sum(
+        b - a - 1 for a, b in zip(sequences, sequences[1:]) if b - a > 1
+    )
+    repeats = sum(1 for a, b in zip(sequences, sequences[1:]) if b == a)
+    duration_us = device_times[-1] - device_times[0]
+
+    print(f"reports:               {len(reports)}")
+    print(f"capture length:        {duration_us / 1e6:.3f} s")
+    print(f"report rate:           {len(reports) * 1e6 / max(1, duration_us):.1f} Hz")
+    print(f"missed sequence nos.:  {gaps}")
+    print(f"repeated reports:      {repeats}")
+
+    # Device clock vs USB frame clock: frame n starts at 1000 * n us of the
+    # host's clock, so the SOF timestamps give the device clock's drift.
+    sof_times = [d - r.sof_offset for d, r in zip(device_times, reports)]
+    frame_slope, _ = fit_line(
+        [(f * 1000.0, s) for f, s in zip(frames, sof_times)]
+    )
+    print(f"device vs USB clock:   {(frame_slope - 1.0) * 1e6:+.1f} ppm")
+
+    delivery, host_slope = delivery_times(reports, device_times)
+    print(f"device vs host clock:  {host_slope * 1e6:+.1f} ppm")
+    print()
+
+    phase = [r.sof_offset for r in reports]
+    all_ages = []
+    end_to_end = []
+    panel_ages = {name: [] for name in PANEL_NAMES}
+
+    for report, deliver in zip(reports, delivery):
+        for name, age in zip(PANEL_NAMES, report.ages):
+            if age == AGE_UNKNOWN:
+                continue
+            panel_ages[name].append(age)
+            all_ages.append(age)
+            end_to_end.append(age + deliver)
+
+    summarize("frame phase", phase)
+    summarize("sample age", all_ages)
+    if per_panel:
+        for name in PANEL_NAMES:
+            summarize(f"  {name}", panel_ages[name])
+    summarize("delivery (>= bound)", delivery)
+    summarize("end to end (>= bound)", end_to_end)
+
+    histogram("sample age", all_ages, bucket_us)
+    histogram("end to end", end_to_end, bucket_us)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-n", "--count", type=int, default=10000,
+                        help="number of reports to capture")
+    parser.add_argument("-b", "--bucket", type=float, default=100.0,
+                        help="histogram bucket size in microseconds")
+    parser.add_argument("-t", "--timeout", type=int, default=1000,
+                        help="read timeout in milliseconds")
+    parser.add_argument("-p", "--per-panel", action="store_true",
+                        help="also show sample age per panel")
+    args = parser.parse_args()
+
+    reports = capture(args.count, args.timeout)
+
+    if len(reports) < 2:
+        print("Not enough reports captured", file=sys.stderr)
+        return 1
+
+    analyze(reports, args.bucket, args.per_panel)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
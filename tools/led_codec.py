@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+"""LED frame encoder for the RE:Flex Dance I/O board's bulk endpoint.
+
+Encodes lighting frames in the formats the firmware can decode (see
+Inc/led_frame.h): raw, run length, palette and XOR delta against the
+previous frame, picking whichever is smallest for each frame.
+
+Run as a script it benchmarks the formats on a set of representative
+animations, printing the size of each format and the share of frames each
+one wins. With --device the chosen encoding of every frame is also streamed
+to the board, after which the decode cycle counters (led_codec_cycles_last
+and led_codec_cycles_max, one entry per format) can be read with a debugger.
+
+Streaming requires the 'pyusb' package (pip install pyusb).
+"""
+
+import argparse
+import colorsys
+import math
+import random
+import struct
+import sys
+import time
+
+VENDOR_ID = 1155
+PRODUCT_ID = 22353
+BULK_INTERFACE = 2
+BULK_ENDPOINT = 0x03
+PACKET_SIZE = 64
+
+PANELS = 4
+SEGMENTS_PER_PANEL = 4
+BYTES_PER_SEGMENT = 64
+PIXELS_PER_SEGMENT = 21
+PIXELS_PER_PANEL = PIXELS_PER_SEGMENT * SEGMENTS_PER_PANEL
+PIXEL_COUNT = PIXELS_PER_PANEL * PANELS
+FRAME_SIZE = BYTES_PER_SEGMENT * SEGMENTS_PER_PANEL * PANELS
+
+FORMAT_RAW = 0
+FORMAT_RLE = 1
+FORMAT_PALETTE = 2
+FORMAT_DELTA = 3
+FORMAT_NAMES = ("raw", "rle", "palette", "delta")
+
+PALETTE_MAX_COLORS = 16
+MAX_RUN = 255
+
+# A frame lost on the way leaves the firmware rejecting every delta frame
+# after it, so at most this many frames follow before a frame in another
+# format brings it back in step
+KEY_FRAME_INTERVAL = 30
+
+# <format, frame number, payload length>
+HEADER = struct.Struct("<BBH")
+
+
+def encode_raw(pixels):
+    frame = bytearray(FRAME_SIZE)
+    for i, (r, g, b) in enumerate(pixels):
+        segment, index = divmod(i, PIXELS_PER_SEGMENT)
+        offset = segment * BYTES_PER_SEGMENT + 1 + index * 3
+        frame[offset:offset + 3] = bytes((r, g, b))
+    return bytes(frame)
+
+
+def encode_rle(pixels):
+    out = bytearray()
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while (i + run < len(pixels) and run < MAX_RUN
+               and pixels[i + run] == pixels[i]):
+            run += 1
+        out.append(run)
+        out.extend(pixels[i])
+        i += run
+    return bytes(out)
+
+
+def encode_palette(pixels):
+    palette = list(dict.fromkeys(pixels))
+    if len(palette) > PALETTE_MAX_COLORS:
+        return None
+
+    index = {color: i for i, color in enumerate(palette)}
+    out = bytearray([len(palette)])
+    for color in palette:
+        out.extend(color)
+    for i in range(0, len(pixels), 2):
+        out.append(index[pixels[i]] | (index[pixels[i + 1]] << 4))
+    return bytes(out)
+
+
+def encode_delta(previous, pixels):
+    out = bytearray()
+    i = 0
+    while i < len(pixels):
+        skip = 0
+        while (i < len(pixels) and skip < MAX_RUN
+               and pixels[i] == previous[i]):
+            skip += 1
+            i += 1
+
+        start = i
+        while (i < len(pixels) and i - start < MAX_RUN
+               and pixels[i] != previous[i]):
+            i += 1
+
+        if i == start and i == len(pixels):
+            break
+
+        out.append(skip)
+        out.append(i - start)
+        for j in range(start, i):
+            out.extend(a ^ b for a, b in zip(pixels[j], previous[j]))
+    return bytes(out)
+
+
+def encodings(previous, pixels):
+    """Every format the frame can be encoded in, as {format: payload}."""
+    result = {
+        FORMAT_RAW: encode_raw(pixels),
+        FORMAT_RLE: encode_rle(pixels),
+    }
+    palette = encode_palette(pixels)
+    if palette is not None:
+        result[FORMAT_PALETTE] = palette
+    if previous is not None:
+        result[FORMAT_DELTA] = encode_delta(previous, pixels)
+    return result
+
+
+def packet(fmt, frame_number, payload):
+    data = HEADER.pack(fmt, frame_number & 0xFF, len(payload)) + payload
+    # A transfer ends on a short packet. Pad one byte rather than rely on the
+    # host sending a zero length packet; the firmware ignores the excess.
+    if len(data) % PACKET_SIZE == 0:
+        data += b"\x00"
+    return data
+
+
+class Encoder:
+    """Picks the smallest format per frame. A delta frame is only valid when
+    it directly follows the frame it was computed against, so the caller
+    must send every packet this returns, in order. Every KEY_FRAME_INTERVAL
+    frames, and after force_key_frame(), a frame in one of the other formats
+    is sent regardless."""
+
+    def __init__(self, key_frame_interval=KEY_FRAME_INTERVAL):
+        self.previous = None
+        self.frame_number = 0
+        self.key_frame_interval = key_frame_interval
+        self.since_key_frame = 0
+
+    def force_key_frame(self):
+        """To be called when the board may have missed a frame, such as when
+        its rejected bulk frame count goes up, so the next frame gets it back
+        in step."""
+        self.since_key_frame = self.key_frame_interval
+
+    def encode(self, pixels):
+        key_frame = self.since_key_frame >= self.key_frame_interval
+        options = encodings(None if key_frame else self.previous, pixels)
+        fmt = min(options, key=lambda f: len(options[f]))
+        if fmt == FORMAT_DELTA:
+            self.since_key_frame += 1
+        else:
+            self.since_key_frame = 0
+        self.previous = list(pixels)
+        self.frame_number = (self.frame_number + 1) & 0xFF
+        return fmt, packet(fmt, self.frame_number, options[fmt])
+
+
+def decode(fmt, payload, previous):
+    """Reference decoder, mirrors Src/led_codec.c. Returns the pixel list."""
+    if fmt == FORMAT_RAW:
+        return [
+            tuple(payload[s * BYTES_PER_SEGMENT + 1 + p * 3:][:3])
+            for s in range(SEGMENTS_PER_PANEL * PANELS)
+            for p in range(PIXELS_PER_SEGMENT)
+        ]
+    if fmt == FORMAT_RLE:
+        pixels = []
+        for i in range(0, len(payload), 4):
+            pixels.extend([tuple(payload[i + 1:i + 4])] * payload[i])
+        return pixels
+    if fmt == FORMAT_PALETTE:
+        count = payload[0]
+        palette = [tuple(payload[1 + i * 3:4 + i * 3]) for i in range(count)]
+        pixels = []
+        for byte in payload[1 + count * 3:]:
+            pixels.append(palette[byte & 0x0F])
+            pixels.append(palette[byte >> 4])
+        return pixels
+    if fmt == FORMAT_DELTA:
+        pixels = list(previous)
+        i = 0
+        pixel = 0
+        while i < len(payload):
+            pixel += payload[i]
+            count = payload[i + 1]
+            i += 2
+            for _ in range(count):
+                pixels[pixel] = tuple(
+                    a ^ b for a, b in zip(pixels[pixel], payload[i:i + 3]))
+                pixel += 1
+                i += 3
+        return pixels
+    raise ValueError(f"unknown format {fmt}")
+
+
+# -- Representative animations ------------------------------------------------
+
+def rgb(h, s, v):
+    return tuple(int(c * 255) for c in colorsys.hsv_to_rgb(h % 1.0, s, v))
+
+
+def anim_solid(frames):
+    for f in range(frames):
+        color = rgb(0.1 * (f // 30), 1.0, 1.0)
+        yield [color] * PIXEL_COUNT
+
+
+def anim_rainbow(frames):
+    for f in range(frames):
+        yield [rgb(i / PIXELS_PER_PANEL + f / 120.0, 1.0, 1.0)
+               for i in range(PIXEL_COUNT)]
+
+
+def anim_panel_fade(frames):
+    """Each panel lit in its own colour on a step, fading out afterwards."""
+    rng = random.Random(1)
+    levels = [0.0] * PANELS
+    hues = (0.0, 0.33, 0.66, 0.83)
+    for _ in range(frames):
+        for p in range(PANELS):
+            if rng.random() < 0.05:
+                levels[p] = 1.0
+            else:
+                levels[p] = max(0.0, levels[p] - 0.08)
+        yield [rgb(hues[i // PIXELS_PER_PANEL], 1.0,
+                   levels[i // PIXELS_PER_PANEL])
+               for i in range(PIXEL_COUNT)]
+
+
+def anim_chase(frames):
+    for f in range(frames):
+        head = f % PIXELS_PER_PANEL
+        yield [
+            (255, 255, 255) if i % PIXELS_PER_PANEL == head
+            else (0, 0, 64) for i in range(PIXEL_COUNT)
+        ]
+
+
+def anim_ripple(frames):
+    for f in range(frames):
+        yield [rgb(0.6, 1.0, 0.5 + 0.5 * math.sin(i * 0.3 - f * 0.2))
+               for i in range(PIXEL_COUNT)]
+
+
+def anim_noise(frames):
+    rng = random.Random(2)
+    for _ in range(frames):
+        yield [tuple(rng.randrange(256) for _ in range(3))
+               for _ in range(PIXEL_COUNT)]
+
+
+ANIMATIONS = {
+    "solid": anim_solid,
+    "rainbow": anim_rainbow,
+    "panel fade": anim_panel_fade,
+    "chase": anim_chase,
+    "ripple": anim_ripple,
+    "noise": anim_noise,
+}
+
+
+# -- Benchmark ----------------------------------------------------------------
+
+def open_device():
+    import usb.core
+    import usb.util
+
+    device = usb.core.find(idVendor=VENDOR_ID, idProduct=PRODUCT_ID)
+    if device is None:
+        raise RuntimeError("I/O board not found")
+
+    # The HID interfaces are the OS's; only the bulk one is claimed, and the
+    # configuration is left alone unless nobody has set it yet
+    try:
+        device.get_active_configuration()
+    except usb.core.USBError:
+        device.set_configuration()
+    usb.util.claim_interface(device, BULK_INTERFACE)
+    return device
+
+
+def benchmark(frames, device, fps):
+    raw_size = HEADER.size + FRAME_SIZE
+    header = f"{'animation':<12}" + "".join(
+        f"{name:>10}" for name in FORMAT_NAMES) + f"{'chosen':>10}{'ratio':>8}  wins"
+    print(header)
+
+    for name, animation in ANIMATIONS.items():
+        encoder = Encoder()
+        totals = {fmt: 0 for fmt in range(len(FORMAT_NAMES))}
+        counts = {fmt: 0 for fmt in range(len(FORMAT_NAMES))}
+        wins = {fmt: 0 for fmt in range(len(FORMAT_NAMES))}
+        chosen = 0
+        count = 0
+
+        for pixels in animation(frames):
+            for fmt, payload in encodings(encoder.previous, pixels).items():
+                totals[fmt] += HEADER.size + len(payload)
+                counts[fmt] += 1
+
+            previous = encoder.previous
+            fmt, data = encoder.encode(pixels)
+            wins[fmt] += 1
+            chosen += len(data)
+            count += 1
+
+            if decode(fmt, data[HEADER.size:], previous)[:PIXEL_COUNT] != pixels:
+                raise AssertionError(f"{name}: {FORMAT_NAMES[fmt]} round trip failed")
+
+            if device is not None:
+                device.write(BULK_ENDPOINT, data)
+                if fps:
+                    time.sleep(1.0 / fps)
+
+        average = chosen / count
+        columns = "".join(
+            f"{totals[f] / counts[f]:10.0f}" if counts[f] else f"{'-':>10}"
+            for f in range(len(FORMAT_NAMES)))
+        won = " ".join(
+            f"{FORMAT_NAMES[f]}={wins[f]}" for f in wins if wins[f])
+        print(f"{name:<12}{columns}{average:10.0f}{raw_size / average:8.2f}  {won}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-n", "--frames", type=int, default=300,
+                        help="frames per animation")
+    parser.add_argument("-d", "--device", action="store_true",
+                        help="also stream the encoded frames to the board")
+    parser.add_argument("-r", "--rate", type=float, default=60.0,
+                        help="frame rate when streaming, 0 for flat out")
+    args = parser.parse_args()
+
+    device = open_device() if args.device else None
+    benchmark(args.frames, device, args.rate)
+
+    if device is not None:
+        print("\nRead led_codec_cycles_last / led_codec_cycles_max with a "
+              "debugger for decode cycles per format.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())